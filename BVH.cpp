@@ -2,34 +2,429 @@
 
 #define MAX_PRIMITIVES 3
 #define MAX_DEPTH 20
-#define BINS_COUNT 10
+#define BINS_COUNT 16
+#define MAX_BINS_COUNT 32
 
-BVH::BVH(std::vector<Primitive*> primitives)
+#define PARALLEL_BUILD_THRESHOLD 16384 // objects, smaller trees are built on the calling thread
+#define MIN_SUBTREE_SIZE 1024 // objects, smaller subtrees are not split into further jobs
+
+#define SPATIAL_SPLIT_BUDGET 0.3f // references the spatial split builder may add, relative to the objects count
+#define SPATIAL_SPLIT_ALPHA 1e-5f // minimal overlap of the object split children, relative to the root, to try spatial splits
+
+#define MORTON_BITS 10 // per axis, codes are 30 bits
+#define RADIX_BITS 10 // digit size of the radix sort, one pass per axis
+#define LBVH_ROTATIONS 1 // improve linear BVHs with tree rotations
+
+#define TRAVERSAL_COST 1.0f // cost estimates of the build report
+#define INTERSECTION_COST 1.0f
+
+// -------------------- BIN ------------------------------------
+
+void BVH::Bin::reset()
+{
+	this->min = vec3(INFINITY);
+	this->max = vec3(-INFINITY);
+	this->count = 0;
+}
+
+void BVH::Bin::grow(vec3 min, vec3 max)
+{
+	this->min = vec3(MIN(this->min.x, min.x), MIN(this->min.y, min.y), MIN(this->min.z, min.z));
+	this->max = vec3(MAX(this->max.x, max.x), MAX(this->max.y, max.y), MAX(this->max.z, max.z));
+}
+
+void BVH::Bin::merge(const Bin& bin)
+{
+	this->grow(bin.min, bin.max);
+	this->count += bin.count;
+}
+
+float BVH::Bin::calculateSurfaceArea()
+{
+	vec3 diagonal = this->max - this->min;
+
+	return ((diagonal.x * diagonal.y) + (diagonal.x * diagonal.z) + (diagonal.z * diagonal.y)) * 2;
+}
+
+// -------------------- JOBS ------------------------------------
+
+void BVHBinningJob::Main()
+{
+	if (this->calculateCenterBounds)
+	{
+		this->bvh->calculateCenterBounds(this->first, this->count, this->centerMin, this->centerMax);
+	}
+	else
+	{
+		this->bvh->binObjects(this->first, this->count, this->centerMin, this->centerMax, this->binCount, this->bins);
+	}
+}
+
+void BVHSubdivisionJob::Main()
+{
+	this->bvh->subdivide(this->node, this->depth);
+}
+
+void MortonSortJob::Main()
+{
+	const unsigned int mask = (1 << RADIX_BITS) - 1;
+
+	if (this->scatter)
+	{
+		// offsets hold the first free position of every digit within the destination
+		for (int i = this->first; i < this->first + this->count; i++)
+		{
+			unsigned int digit = (this->source[i].code >> this->shift) & mask;
+			this->destination[this->offsets[digit]++] = this->source[i];
+		}
+	}
+	else
+	{
+		for (int i = 0; i <= mask; i++) this->offsets[i] = 0;
+
+		for (int i = this->first; i < this->first + this->count; i++)
+		{
+			this->offsets[(this->source[i].code >> this->shift) & mask]++;
+		}
+	}
+}
+
+// -------------------- BVH ------------------------------------
+
+BVH::BVH(std::vector<Primitive*> primitives, TriangleMesh* mesh)
 {
 	this->primitives = primitives;
+	this->mesh = mesh;
+
+	this->nodes = NULL;
+	this->nodesUsed = 0;
+	this->nodesAllocated = 0;
+	this->buildNodes = NULL;
+	this->objectIndices = NULL;
+	this->objectIndicesCount = 0;
+	this->bvh4 = NULL;
+	this->bvh8 = NULL;
+	this->packets4 = NULL;
+	this->packets8 = NULL;
+	this->packetsCount = 0;
+	this->packetIndices = NULL;
+	this->primitiveArrays = NULL;
+	this->primitiveReferences = NULL;
+	this->leafSize = MAX_PRIMITIVES;
+
+	this->buildMode = binnedSAH;
+	this->objectsCount = 0;
+	this->referencesCount = 0;
+	this->SAHCost = 0;
+	this->buildTime = 0;
+	this->spatialSplitsCount = 0;
 }
 
-void BVH::build(int id, int startIndex, int endIndex)
+BVH::~BVH()
 {
+	FREE64(this->nodes);
+	delete[] this->objectIndices;
+	delete this->bvh4;
+	delete this->bvh8;
+	FREE64(this->packets4);
+	FREE64(this->packets8);
+	delete[] this->packetIndices;
+	delete this->primitiveArrays;
+	delete[] this->primitiveReferences;
+}
+
+void BVH::build(int id, int startIndex, int endIndex, BVHBuildMode buildMode)
+{
+	std::chrono::steady_clock::time_point buildStart = std::chrono::steady_clock::now();
+
 	this->id = id;
+	this->buildMode = buildMode;
+	this->startIndex = startIndex;
+	this->endIndex = endIndex;
+
+	// a packet of mesh triangles costs about as much as a single test, SAH decides on larger leaves
+	bool packed = this->mesh != NULL && TRIANGLE_PACKET_WIDTH > 1;
+	this->leafSize = packed ? TRIANGLE_PACKET_WIDTH : MAX_PRIMITIVES;
+
+	// mesh triangles have no bounding boxes of their own, they are only needed during the build
+	BoundingBox* triangleBounds = NULL;
+	if (this->mesh != NULL)
+	{
+		this->objectIndicesCount = this->mesh->count;
+		this->objectIndices = new int[this->mesh->count];
+		triangleBounds = new BoundingBox[this->mesh->count];
+		for (int i = 0; i < this->mesh->count; i++)
+		{
+			this->objectIndices[i] = i;
+			this->mesh->calculateBounds(i, triangleBounds[i]);
+			this->boundingBoxes.push_back(&triangleBounds[i]);
+		}
+	}
+	else
+	{
+		this->objectIndicesCount = this->primitives.size();
+		this->objectIndices = new int[this->primitives.size()];
+		for (int i = 0; i < this->primitives.size(); i++)
+		{
+			objectIndices[i] = this->primitives[i]->id;
+		}
+
+		for (int i = 0; i < this->primitives.size(); i++)
+		{
+			this->boundingBoxes.push_back(this->primitives[i]->boundingBox);
+		}
+	}
+
+	int objectCount = endIndex - startIndex + 1;
+	this->objectsCount = objectCount;
+	this->referencesCount = objectCount;
+
+	// spatial splits may reference objects more than once, both node arrays are sized for the largest references count
+	int maxReferencesCount = objectCount;
+	if (buildMode == spatialSplits)
+	{
+		this->duplicationBudget = (int)(objectCount * SPATIAL_SPLIT_BUDGET);
+		maxReferencesCount += this->duplicationBudget;
+	}
+	this->allocateNodes(maxReferencesCount);
+
+	this->buildNodesCount = MAX(2 * maxReferencesCount - 1, 1);
+	this->buildNodes = (BVHNode*)MALLOC64(this->buildNodesCount * sizeof(BVHNode));
+	this->buildNodesUsed = 1;
+
+	BVHNode* root = &this->buildNodes[0];
+	root->leftFirst = startIndex;
+	root->count = objectCount;
+
+	calculateBounds(root);
+
+	if (buildMode == spatialSplits)
+	{
+		std::vector<Reference> references(objectCount);
+		for (int i = 0; i < objectCount; i++)
+		{
+			references[i].index = this->objectIndices[startIndex + i];
+			references[i].bounds = *this->boundingBoxes[references[i].index];
+		}
+
+		this->rootSurfaceArea = root->calculateSurfaceArea();
+		this->spatialSplitsCount = 0;
+		this->subdivideSpatial(root, references, 0);
+
+		// leaves index the references instead of the objects
+		delete[] this->objectIndices;
+		this->referencesCount = this->leafReferences.size();
+		this->objectIndicesCount = this->referencesCount;
+		this->objectIndices = new int[this->referencesCount];
+		for (int i = 0; i < this->referencesCount; i++)
+		{
+			this->objectIndices[i] = this->leafReferences[i];
+		}
+		std::vector<int>().swap(this->leafReferences);
+	}
+	else if (buildMode == mortonCodes)
+	{
+		subdivideLinear(root);
+	}
+	else if (MULTITHREADING_ENABLED && JobManager::GetJobManager() && objectCount >= PARALLEL_BUILD_THRESHOLD)
+	{
+		subdivideParallel(root);
+	}
+	else
+	{
+		subdivide(root, 0);
+	}
+
+	// lay the tree out depth-first
+	this->nodesUsed = 0;
+	this->flatten(root);
+
+	FREE64(this->buildNodes);
+	this->buildNodes = NULL;
+
+	this->SAHCost = this->calculateSAHCost();
+
+	if (this->mesh != NULL)
+	{
+		this->boundingBoxes.clear();
+		delete[] triangleBounds;
+	}
+
+	// collapse the binary tree into the node format used for traversal
+	if (BVH_WIDTH == 4) this->bvh4 = new BVH4(this);
+	if (BVH_WIDTH == 8) this->bvh8 = new BVH8(this);
+
+	if (packed && TRIANGLE_PACKET_WIDTH == 4) this->packets4 = this->packTriangles<TrianglePacket4>();
+	if (packed && TRIANGLE_PACKET_WIDTH == 8) this->packets8 = this->packTriangles<TrianglePacket8>();
+	if (this->mesh == NULL) this->groupPrimitives();
+
+	this->buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+}
+
+void BVH::rebuild()
+{
+	// objects moved or deformed, build again from scratch with the same build mode
+	FREE64(this->nodes);
+	delete[] this->objectIndices;
+	delete this->bvh4;
+	delete this->bvh8;
+	FREE64(this->packets4);
+	FREE64(this->packets8);
+	delete[] this->packetIndices;
+	delete this->primitiveArrays;
+	delete[] this->primitiveReferences;
+	this->bvh4 = NULL;
+	this->bvh8 = NULL;
+	this->packets4 = NULL;
+	this->packets8 = NULL;
+	this->packetsCount = 0;
+	this->packetIndices = NULL;
+	this->primitiveArrays = NULL;
+	this->primitiveReferences = NULL;
+	this->boundingBoxes.clear();
+
+	this->build(this->id, this->startIndex, this->endIndex, this->buildMode);
+}
+
+void BVH::allocateNodes(int objectCount)
+{
+	// a binary tree with non-empty leaves never has more than 2n - 1 nodes
+	int maxNodesCount = MAX(2 * objectCount - 1, 1);
+
+	this->nodes = (BVHNode*)MALLOC64(maxNodesCount * sizeof(BVHNode));
+	this->nodesUsed = 1;
+	this->nodesAllocated = maxNodesCount;
+}
+
+void BVH::translate(vec3 vector)
+{
+	for (int i = 0; i < this->nodesUsed; i++)
+	{
+		this->nodes[i].translate(vector);
+	}
+
+	if (this->bvh4) this->bvh4->translate(vector);
+	if (this->bvh8) this->bvh8->translate(vector);
+}
+
+void BVH::printReport(const char* name)
+{
+	printf("%s: %s build, %i objects, %i references (duplication factor %.3f), %i spatial splits, %i nodes, SAH cost %.2f, %.2f ms\n",
+		name,
+		this->buildMode == spatialSplits ? "spatial split" : this->buildMode == mortonCodes ? "Morton code" : "binned SAH",
+		this->objectsCount,
+		this->referencesCount,
+		(float)this->referencesCount / MAX(this->objectsCount, 1),
+		this->spatialSplitsCount,
+		this->nodesUsed,
+		this->SAHCost,
+		this->buildTime
+	);
+}
+
+size_t BVH::calculateMemoryUsage()
+{
+	size_t bytes = this->nodesAllocated * sizeof(BVHNode) + this->objectIndicesCount * sizeof(int);
+	if (this->bvh4) bytes += this->bvh4->nodesAllocated * sizeof(BVH4Node);
+	if (this->bvh8) bytes += this->bvh8->nodesAllocated * sizeof(BVH8Node);
+	if (this->packets4) bytes += this->packetsCount * sizeof(TrianglePacket4);
+	if (this->packets8) bytes += this->packetsCount * sizeof(TrianglePacket8);
+	if (this->packetIndices) bytes += this->objectIndicesCount * sizeof(int);
+	if (this->primitiveArrays) bytes += this->primitiveArrays->calculateMemoryUsage();
+	if (this->primitiveReferences) bytes += this->objectIndicesCount * sizeof(int);
+
+	return bytes;
+}
 
-	this->objectIndices = new int[this->primitives.size()];
-	for (int i = 0; i < this->primitives.size(); i++)
+float BVH::calculateSAHCost()
+{
+	// expected cost of a ray hitting the root, the probability to visit a node is its surface area relative to the root
+	float rootSurfaceArea = this->nodes[0].calculateSurfaceArea();
+	if (rootSurfaceArea <= 0)
 	{
-		objectIndices[i] = this->primitives[i]->id;
+		return this->nodes[0].count * INTERSECTION_COST;
 	}
 
-	for (int i = 0; i < this->primitives.size(); i++)
+	float cost = 0;
+	for (int i = 0; i < this->nodesUsed; i++)
 	{
-		this->boundingBoxes.push_back(this->primitives[i]->boundingBox);
+		float probability = this->nodes[i].calculateSurfaceArea() / rootSurfaceArea;
+		cost += probability * (this->nodes[i].isLeaf() ? this->calculateLeafCost(this->nodes[i].count) * INTERSECTION_COST : TRAVERSAL_COST);
 	}
 
-	this->root = new BVHNode();
-	this->root->first = startIndex;
-	this->root->count = endIndex - startIndex + 1;
+	return cost;
+}
+
+int BVH::calculateLeafCost(int count)
+{
+	// intersection tests of a leaf, packed mesh triangles are tested TRIANGLE_PACKET_WIDTH at a time
+	if (this->mesh == NULL || TRIANGLE_PACKET_WIDTH == 1) return count;
 
-	calculateBounds(this->root);
-	subdivide(this->root, 0);
+	return (count + TRIANGLE_PACKET_WIDTH - 1) / TRIANGLE_PACKET_WIDTH;
+}
+
+template <class Packet>
+Packet* BVH::packTriangles()
+{
+	// leaves are disjoint ranges of the object indices, their triangles are copied into consecutive packets
+	int packetsCount = 0;
+	for (int i = 0; i < this->nodesUsed; i++)
+	{
+		if (this->nodes[i].isLeaf()) packetsCount += (this->nodes[i].count + Packet::WIDTH - 1) / Packet::WIDTH;
+	}
+
+	Packet* packets = (Packet*)MALLOC64(MAX(packetsCount, 1) * sizeof(Packet));
+	this->packetsCount = packetsCount;
+	this->packetIndices = new int[MAX(this->referencesCount, 1)];
+
+	int packetsUsed = 0;
+	for (int i = 0; i < this->nodesUsed; i++)
+	{
+		BVHNode* node = &this->nodes[i];
+		if (!node->isLeaf()) continue;
+
+		this->packetIndices[node->leftFirst] = packetsUsed;
+		for (int j = 0; j < node->count; j += Packet::WIDTH)
+		{
+			Packet* packet = &packets[packetsUsed++];
+			for (int lane = 0; lane < Packet::WIDTH; lane++)
+			{
+				packet->set(lane, this->mesh, j + lane < node->count ? this->objectIndices[node->leftFirst + j + lane] : -1);
+			}
+		}
+	}
+
+	return packets;
+}
+
+void BVH::groupPrimitives()
+{
+	this->primitiveArrays = new PrimitiveArrays();
+	// leaves index the object indices of the whole scene unless spatial splits replaced them with references
+	int objectIndicesCount = this->buildMode == spatialSplits ? this->referencesCount : this->primitives.size();
+	this->primitiveReferences = new int[MAX(objectIndicesCount, 1)];
+
+	// spatial splits can reference a primitive from several leaves, it is copied only once
+	std::map<int, int> references;
+	for (int i = 0; i < this->nodesUsed; i++)
+	{
+		BVHNode* node = &this->nodes[i];
+		if (!node->isLeaf()) continue;
+
+		// the type switch of the leaf loop takes the same branch for consecutive primitives
+		int* first = &this->objectIndices[node->leftFirst];
+		std::stable_sort(first, first + node->count, [this](int a, int b) { return this->primitives[a]->type < this->primitives[b]->type; });
+
+		for (int j = node->leftFirst; j < node->leftFirst + node->count; j++)
+		{
+			int index = this->objectIndices[j];
+			if (references.find(index) == references.end())
+			{
+				references[index] = this->primitiveArrays->add(this->primitives[index]);
+			}
+			this->primitiveReferences[j] = references[index];
+		}
+	}
 }
 
 void BVH::calculateBounds(BVHNode* node)
@@ -37,7 +432,7 @@ void BVH::calculateBounds(BVHNode* node)
 	float maxX = -INFINITY, maxY = -INFINITY, maxZ = -INFINITY;
 	float minX = INFINITY, minY = INFINITY, minZ = INFINITY;
 
-	for (int i = node->first; i < node->first + node->count; i++)
+	for (int i = node->leftFirst; i < node->leftFirst + node->count; i++)
 	{
 		int index = this->objectIndices[i];
 		minX = MIN(this->boundingBoxes[index]->min.x, minX);
@@ -49,129 +444,887 @@ void BVH::calculateBounds(BVHNode* node)
 		maxZ = MAX(this->boundingBoxes[index]->max.z, maxZ);
 	}
 
-	node->boundingBox->min = vec3(minX, minY, minZ);
-	node->boundingBox->max = vec3(maxX, maxY, maxZ);
-	node->boundingBox->calculateCenter();
+	node->setBounds(vec3(minX, minY, minZ), vec3(maxX, maxY, maxZ));
 }
 
 void BVH::subdivide(BVHNode* node, int depth)
 {
-	if (node->count <= MAX_PRIMITIVES || depth >= MAX_DEPTH)
+	if (node->count <= this->leafSize || depth >= MAX_DEPTH)
+	{
+		return;
+	}
+
+	BVHNode left, right;
+	if (!this->partition(node, &left, &right, BINS_COUNT))
 	{
-		node->isLeaf = true;
+		// splitting is more expensive than intersecting all objects in this leaf
 		return;
 	}
 
-	node->left = new BVHNode();
-	node->right = new BVHNode();
+	// children are allocated in pairs, flatten() establishes the depth-first order afterwards
+	int leftIndex = this->buildNodesUsed.fetch_add(2);
+	assert(leftIndex + 1 < this->buildNodesCount);
+	this->buildNodes[leftIndex] = left;
+	this->buildNodes[leftIndex + 1] = right;
 
-	this->partition(node, BINS_COUNT);
+	node->leftFirst = leftIndex;
+	node->count = 0;
 
 	depth++;
-	this->subdivide(node->left, depth);
-	this->subdivide(node->right, depth);
+	this->subdivide(&this->buildNodes[leftIndex], depth);
+	this->subdivide(&this->buildNodes[leftIndex + 1], depth);
+}
+
+void BVH::subdivideParallel(BVHNode* root)
+{
+	JobManager* jobManager = JobManager::GetJobManager();
+	int subtreeSize = MAX(MIN_SUBTREE_SIZE, root->count / (4 * (int)jobManager->GetNumThreads()));
+
+	// split the top levels with parallel binning until the subtrees are small enough to be built by one job each
+	std::vector<BVHNode*> openNodes, subtrees;
+	std::vector<int> openDepths, subtreeDepths;
+	openNodes.push_back(root);
+	openDepths.push_back(0);
+
+	while (!openNodes.empty())
+	{
+		BVHNode* node = openNodes.back();
+		int depth = openDepths.back();
+		openNodes.pop_back();
+		openDepths.pop_back();
+
+		if (node->count <= subtreeSize || depth >= MAX_DEPTH)
+		{
+			subtrees.push_back(node);
+			subtreeDepths.push_back(depth);
+			continue;
+		}
+
+		BVHNode left, right;
+		if (!this->partitionParallel(node, &left, &right, BINS_COUNT))
+		{
+			continue;
+		}
+
+		int leftIndex = this->buildNodesUsed.fetch_add(2);
+		assert(leftIndex + 1 < this->buildNodesCount);
+		this->buildNodes[leftIndex] = left;
+		this->buildNodes[leftIndex + 1] = right;
+
+		node->leftFirst = leftIndex;
+		node->count = 0;
+
+		openNodes.push_back(&this->buildNodes[leftIndex]);
+		openNodes.push_back(&this->buildNodes[leftIndex + 1]);
+		openDepths.push_back(depth + 1);
+		openDepths.push_back(depth + 1);
+	}
+
+	// subtrees touch disjoint object ranges and only share the atomic node counter
+	BVHSubdivisionJob* jobs = new BVHSubdivisionJob[subtrees.size()];
+	for (int i = 0; i < subtrees.size(); i++)
+	{
+		jobs[i].bvh = this;
+		jobs[i].node = subtrees[i];
+		jobs[i].depth = subtreeDepths[i];
+
+		jobManager->AddJob2(&jobs[i]);
+	}
+	jobManager->RunJobs();
+
+	delete[] jobs;
+}
+
+int BVH::flatten(BVHNode* buildNode)
+{
+	int index = this->nodesUsed++;
+	this->nodes[index] = *buildNode;
+
+	if (buildNode->isLeaf())
+	{
+		return index;
+	}
+
+	// left child directly follows its parent, right child is placed after the whole left subtree
+	this->flatten(&this->buildNodes[buildNode->leftFirst]);
+	this->nodes[index].leftFirst = this->flatten(&this->buildNodes[buildNode->leftFirst + 1]);
+
+	return index;
+}
+
+bool BVH::partition(BVHNode* node, BVHNode* left, BVHNode* right, int binCount)
+{
+	assert(binCount <= MAX_BINS_COUNT);
+
+	vec3 centerMin, centerMax;
+	this->calculateCenterBounds(node->leftFirst, node->count, centerMin, centerMax);
+
+	Bin bins[3 * MAX_BINS_COUNT];
+	this->binObjects(node->leftFirst, node->count, centerMin, centerMax, binCount, bins);
+
+	int axis, split;
+	Bin leftBin, rightBin;
+	if (!this->findOptimalSplit(node, centerMin, centerMax, binCount, bins, axis, split, leftBin, rightBin))
+	{
+		return false;
+	}
+
+	this->splitObjects(node, left, right, centerMin, centerMax, binCount, axis, split, leftBin, rightBin);
+
+	return true;
+}
+
+bool BVH::partitionParallel(BVHNode* node, BVHNode* left, BVHNode* right, int binCount)
+{
+	assert(binCount <= MAX_BINS_COUNT);
+
+	JobManager* jobManager = JobManager::GetJobManager();
+	int jobsCount = jobManager->GetNumThreads();
+	int chunkSize = (node->count + jobsCount - 1) / jobsCount;
+
+	std::vector<BVHBinningJob> jobs(jobsCount);
+	Bin* bins = new Bin[jobsCount * 3 * MAX_BINS_COUNT];
+	for (int i = 0; i < jobsCount; i++)
+	{
+		jobs[i].bvh = this;
+		jobs[i].first = node->leftFirst + i * chunkSize;
+		jobs[i].count = MAX(0, MIN(chunkSize, node->count - i * chunkSize));
+		jobs[i].binCount = binCount;
+		jobs[i].bins = &bins[i * 3 * MAX_BINS_COUNT];
+	}
+
+	// bins are placed within the center bounds, which need a pass of their own
+	for (int i = 0; i < jobsCount; i++)
+	{
+		jobs[i].calculateCenterBounds = true;
+		jobManager->AddJob2(&jobs[i]);
+	}
+	jobManager->RunJobs();
+
+	vec3 centerMin = vec3(INFINITY), centerMax = vec3(-INFINITY);
+	for (int i = 0; i < jobsCount; i++)
+	{
+		if (jobs[i].count == 0) continue;
+
+		centerMin = vec3(MIN(centerMin.x, jobs[i].centerMin.x), MIN(centerMin.y, jobs[i].centerMin.y), MIN(centerMin.z, jobs[i].centerMin.z));
+		centerMax = vec3(MAX(centerMax.x, jobs[i].centerMax.x), MAX(centerMax.y, jobs[i].centerMax.y), MAX(centerMax.z, jobs[i].centerMax.z));
+	}
+
+	for (int i = 0; i < jobsCount; i++)
+	{
+		jobs[i].calculateCenterBounds = false;
+		jobs[i].centerMin = centerMin;
+		jobs[i].centerMax = centerMax;
+		jobManager->AddJob2(&jobs[i]);
+	}
+	jobManager->RunJobs();
+
+	// merge the bins of all chunks into the bins of the first one
+	for (int i = 1; i < jobsCount; i++)
+	{
+		for (int j = 0; j < 3 * binCount; j++)
+		{
+			bins[j].merge(jobs[i].bins[j]);
+		}
+	}
+
+	int axis, split;
+	Bin leftBin, rightBin;
+	bool splitFound = this->findOptimalSplit(node, centerMin, centerMax, binCount, bins, axis, split, leftBin, rightBin);
+	delete[] bins;
+
+	if (!splitFound)
+	{
+		return false;
+	}
+
+	this->splitObjects(node, left, right, centerMin, centerMax, binCount, axis, split, leftBin, rightBin);
+
+	return true;
+}
+
+void BVH::calculateCenterBounds(int first, int count, vec3& centerMin, vec3& centerMax)
+{
+	// bins are placed within the bounds of the object centers, not of the objects
+	centerMin = vec3(INFINITY);
+	centerMax = vec3(-INFINITY);
+
+	for (int i = first; i < first + count; i++)
+	{
+		vec3 center = this->boundingBoxes[this->objectIndices[i]]->center;
+		centerMin = vec3(MIN(centerMin.x, center.x), MIN(centerMin.y, center.y), MIN(centerMin.z, center.z));
+		centerMax = vec3(MAX(centerMax.x, center.x), MAX(centerMax.y, center.y), MAX(centerMax.z, center.z));
+	}
+}
+
+void BVH::binObjects(int first, int count, vec3 centerMin, vec3 centerMax, int binCount, Bin* bins)
+{
+	for (int i = 0; i < 3 * binCount; i++) bins[i].reset();
+
+	vec3 extent = centerMax - centerMin;
+	vec3 binScale = vec3(
+		extent.x > 0 ? binCount / extent.x : 0,
+		extent.y > 0 ? binCount / extent.y : 0,
+		extent.z > 0 ? binCount / extent.z : 0
+	);
+
+	for (int i = first; i < first + count; i++)
+	{
+		BoundingBox* box = this->boundingBoxes[this->objectIndices[i]];
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int binIndex = MIN(binCount - 1, (int)((box->center[axis] - centerMin[axis]) * binScale[axis]));
+
+			bins[axis * binCount + binIndex].count++;
+			bins[axis * binCount + binIndex].grow(box->min, box->max);
+		}
+	}
 }
 
-void BVH::partition(BVHNode* node, int binCount)
+bool BVH::findOptimalSplit(BVHNode* node, vec3 centerMin, vec3 centerMax, int binCount, Bin* bins, int& axis, int& split, Bin& leftBin, Bin& rightBin)
 {
-	float optimalSAH = INFINITY;
-	int optimalLeftCount = 1;
-	int optimalRightCount = node->count - optimalLeftCount;
+	float optimalSAH = node->calculateSurfaceArea() * this->calculateLeafCost(node->count);
+	axis = -1;
 
-	int* optimalObjectIndices = new int[node->count];
-	for (int i = 0; i < node->count; i++)
+	Bin rightBins[MAX_BINS_COUNT];
+	for (int a = 0; a < 3; a++)
 	{
-		optimalObjectIndices[i] = this->objectIndices[node->first + i];
+		if (centerMax[a] - centerMin[a] <= 0) continue;
+
+		Bin* axisBins = &bins[a * binCount];
+
+		// sweep from the right to get the bounds of every right side
+		rightBins[binCount - 1] = axisBins[binCount - 1];
+		for (int i = binCount - 2; i > 0; i--)
+		{
+			rightBins[i] = axisBins[i];
+			rightBins[i].merge(rightBins[i + 1]);
+		}
+
+		// sweep from the left and evaluate the split after every bin
+		Bin left = axisBins[0];
+		for (int i = 1; i < binCount; i++)
+		{
+			if (left.count > 0 && rightBins[i].count > 0)
+			{
+				float SAH = left.calculateSurfaceArea() * this->calculateLeafCost(left.count) + rightBins[i].calculateSurfaceArea() * this->calculateLeafCost(rightBins[i].count);
+
+				// save the optimal split according Surface Area Heuristic
+				if (SAH < optimalSAH)
+				{
+					optimalSAH = SAH;
+					axis = a;
+					split = i;
+					leftBin = left;
+					rightBin = rightBins[i];
+				}
+			}
+
+			left.merge(axisBins[i]);
+		}
 	}
 
-	std::vector<int>* bins = new std::vector<int>[binCount];
-	vec3 binWidth = (node->boundingBox->max - node->boundingBox->min) / binCount;
-	if (binWidth.x == 0) binWidth.x = 1;
-	if (binWidth.y == 0) binWidth.y = 1;
-	if (binWidth.z == 0) binWidth.z = 1;
+	return axis != -1;
+}
 
-	for (int axis = 0; axis < 3; axis++)
+void BVH::splitObjects(BVHNode* node, BVHNode* left, BVHNode* right, vec3 centerMin, vec3 centerMax, int binCount, int axis, int split, Bin& leftBin, Bin& rightBin)
+{
+	// partition object indices in place, the same bin computation as in binObjects decides the side
+	float binScale = binCount / (centerMax[axis] - centerMin[axis]);
+	int i = node->leftFirst, j = node->leftFirst + node->count - 1;
+	while (i <= j)
 	{
-		for (int i = 0; i < binCount; i++) bins[i].clear();
+		float center = this->boundingBoxes[this->objectIndices[i]]->center[axis];
+		int binIndex = MIN(binCount - 1, (int)((center - centerMin[axis]) * binScale));
+
+		if (binIndex < split)
+		{
+			i++;
+		}
+		else
+		{
+			swap(this->objectIndices[i], this->objectIndices[j]);
+			j--;
+		}
+	}
+
+	int leftCount = i - node->leftFirst;
+
+	left->leftFirst = node->leftFirst;
+	left->count = leftCount;
+
+	right->leftFirst = node->leftFirst + leftCount;
+	right->count = node->count - leftCount;
+
+	if (leftCount == leftBin.count)
+	{
+		left->setBounds(leftBin.min, leftBin.max);
+		right->setBounds(rightBin.min, rightBin.max);
+	}
+	else
+	{
+		// bin index computation was not reproduced exactly, the bin bounds do not match the objects
+		this->calculateBounds(left);
+		this->calculateBounds(right);
+	}
+}
+
+// -------------------- SPATIAL SPLITS ------------------------------------
+
+void BVH::subdivideSpatial(BVHNode* node, std::vector<Reference>& references, int depth)
+{
+	node->count = references.size();
+
+	if (node->count > this->leafSize && depth < MAX_DEPTH)
+	{
+		// object split, binned by the centers of the clipped reference bounds
+		vec3 centerMin = vec3(INFINITY), centerMax = vec3(-INFINITY);
+		for (int i = 0; i < references.size(); i++)
+		{
+			vec3 center = references[i].bounds.center;
+			centerMin = vec3(MIN(centerMin.x, center.x), MIN(centerMin.y, center.y), MIN(centerMin.z, center.z));
+			centerMax = vec3(MAX(centerMax.x, center.x), MAX(centerMax.y, center.y), MAX(centerMax.z, center.z));
+		}
+
+		Bin bins[3 * MAX_BINS_COUNT];
+		for (int i = 0; i < 3 * BINS_COUNT; i++) bins[i].reset();
+
+		vec3 extent = centerMax - centerMin;
+		vec3 binScale = vec3(
+			extent.x > 0 ? BINS_COUNT / extent.x : 0,
+			extent.y > 0 ? BINS_COUNT / extent.y : 0,
+			extent.z > 0 ? BINS_COUNT / extent.z : 0
+		);
+		for (int i = 0; i < references.size(); i++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				int binIndex = MIN(BINS_COUNT - 1, (int)((references[i].bounds.center[axis] - centerMin[axis]) * binScale[axis]));
+
+				bins[axis * BINS_COUNT + binIndex].count++;
+				bins[axis * BINS_COUNT + binIndex].grow(references[i].bounds.min, references[i].bounds.max);
+			}
+		}
+
+		int objectAxis, objectSplit;
+		Bin leftBin, rightBin;
+		bool objectSplitFound = this->findOptimalSplit(node, centerMin, centerMax, BINS_COUNT, bins, objectAxis, objectSplit, leftBin, rightBin);
+		float objectSAH = objectSplitFound ? leftBin.calculateSurfaceArea() * this->calculateLeafCost(leftBin.count) + rightBin.calculateSurfaceArea() * this->calculateLeafCost(rightBin.count) : INFINITY;
+
+		// spatial splits only pay off where the children of the object split overlap
+		bool trySpatialSplit = !objectSplitFound;
+		if (objectSplitFound)
+		{
+			Bin overlap;
+			overlap.min = vec3(MAX(leftBin.min.x, rightBin.min.x), MAX(leftBin.min.y, rightBin.min.y), MAX(leftBin.min.z, rightBin.min.z));
+			overlap.max = vec3(MIN(leftBin.max.x, rightBin.max.x), MIN(leftBin.max.y, rightBin.max.y), MIN(leftBin.max.z, rightBin.max.z));
+
+			bool overlaps = overlap.min.x <= overlap.max.x && overlap.min.y <= overlap.max.y && overlap.min.z <= overlap.max.z;
+			trySpatialSplit = overlaps && overlap.calculateSurfaceArea() > SPATIAL_SPLIT_ALPHA * this->rootSurfaceArea;
+		}
+
+		float spatialSAH = INFINITY;
+		int spatialAxis;
+		float spatialPosition;
+		bool spatialSplitFound = trySpatialSplit && this->duplicationBudget > 0 &&
+			this->findSpatialSplit(node, references, BINS_COUNT, spatialSAH, spatialAxis, spatialPosition);
 
-		// divide objects to bins
-		for (int i = node->first; i < node->first + node->count; i++)
+		if (objectSplitFound || spatialSplitFound)
 		{
-			int index = this->objectIndices[i], binIndex;
+			std::vector<Reference> leftReferences, rightReferences;
+			bool spatialSplit = spatialSplitFound && spatialSAH < objectSAH;
+			if (spatialSplit)
+			{
+				this->splitReferencesSpatially(references, spatialAxis, spatialPosition, leftReferences, rightReferences);
+			}
+			else
+			{
+				this->splitReferences(references, centerMin, centerMax, BINS_COUNT, objectAxis, objectSplit, leftReferences, rightReferences);
+			}
+
+			// unsplitting can move every reference to one side
+			if (!leftReferences.empty() && !rightReferences.empty())
+			{
+				if (spatialSplit) this->spatialSplitsCount++;
+				std::vector<Reference>().swap(references);
+
+				int leftIndex = this->buildNodesUsed.fetch_add(2);
+				assert(leftIndex + 1 < this->buildNodesCount);
+				BVHNode* left = &this->buildNodes[leftIndex];
+				BVHNode* right = &this->buildNodes[leftIndex + 1];
+				this->calculateBounds(left, leftReferences);
+				this->calculateBounds(right, rightReferences);
+
+				node->leftFirst = leftIndex;
+				node->count = 0;
 
-			if (axis == 0)		binIndex = (this->boundingBoxes[index]->center.x - node->boundingBox->min.x) / binWidth.x;
-			else if (axis == 1)	binIndex = (this->boundingBoxes[index]->center.y - node->boundingBox->min.y) / binWidth.y;
-			else if (axis == 2)	binIndex = (this->boundingBoxes[index]->center.z - node->boundingBox->min.z) / binWidth.z;
+				depth++;
+				this->subdivideSpatial(left, leftReferences, depth);
+				this->subdivideSpatial(right, rightReferences, depth);
 
-			binIndex = MIN(binCount - 1, binIndex);
-			bins[binIndex].push_back(index);
+				return;
+			}
+
+			references = leftReferences.empty() ? rightReferences : leftReferences;
+			node->count = references.size();
 		}
+	}
+
+	node->leftFirst = this->leafReferences.size();
+	for (int i = 0; i < references.size(); i++)
+	{
+		this->leafReferences.push_back(references[i].index);
+	}
+}
+
+void BVH::calculateBounds(BVHNode* node, std::vector<Reference>& references)
+{
+	vec3 min = vec3(INFINITY), max = vec3(-INFINITY);
+	for (int i = 0; i < references.size(); i++)
+	{
+		min = vec3(MIN(min.x, references[i].bounds.min.x), MIN(min.y, references[i].bounds.min.y), MIN(min.z, references[i].bounds.min.z));
+		max = vec3(MAX(max.x, references[i].bounds.max.x), MAX(max.y, references[i].bounds.max.y), MAX(max.z, references[i].bounds.max.z));
+	}
+
+	node->setBounds(min, max);
+	node->count = references.size();
+}
+
+bool BVH::findSpatialSplit(BVHNode* node, std::vector<Reference>& references, int binCount, float& optimalSAH, int& axis, float& position)
+{
+	assert(binCount <= MAX_BINS_COUNT);
+
+	vec3 nodeMin = node->getMin(), nodeMax = node->getMax();
+	optimalSAH = node->calculateSurfaceArea() * this->calculateLeafCost(node->count);
+	axis = -1;
+
+	// bins count the references entering and exiting them, a reference is clipped into every bin it spans
+	Bin bins[MAX_BINS_COUNT], rightBins[MAX_BINS_COUNT];
+	int exits[MAX_BINS_COUNT];
+	for (int a = 0; a < 3; a++)
+	{
+		float binWidth = (nodeMax[a] - nodeMin[a]) / binCount;
+		if (binWidth <= 0) continue;
 
-		// sort objects
-		int count = 0;
 		for (int i = 0; i < binCount; i++)
 		{
-			for (int j = 0; j < bins[i].size(); j++)
+			bins[i].reset();
+			exits[i] = 0;
+		}
+
+		for (int i = 0; i < references.size(); i++)
+		{
+			Reference part = references[i];
+			int first = CLAMP((int)((part.bounds.min[a] - nodeMin[a]) / binWidth), 0, binCount - 1);
+			int last = CLAMP((int)((part.bounds.max[a] - nodeMin[a]) / binWidth), first, binCount - 1);
+
+			for (int j = first; j < last; j++)
+			{
+				Reference left, right;
+				this->splitReference(part, a, nodeMin[a] + (j + 1) * binWidth, left, right);
+
+				if (!left.bounds.isEmpty()) bins[j].grow(left.bounds.min, left.bounds.max);
+				part = right;
+			}
+			if (!part.bounds.isEmpty()) bins[last].grow(part.bounds.min, part.bounds.max);
+
+			bins[first].count++;
+			exits[last]++;
+		}
+
+		// sweep from the right counting exits, from the left counting entries
+		rightBins[binCount - 1] = bins[binCount - 1];
+		rightBins[binCount - 1].count = exits[binCount - 1];
+		for (int i = binCount - 2; i > 0; i--)
+		{
+			rightBins[i] = bins[i];
+			rightBins[i].count = exits[i];
+			rightBins[i].merge(rightBins[i + 1]);
+		}
+
+		Bin left = bins[0];
+		for (int i = 1; i < binCount; i++)
+		{
+			int duplicatesCount = left.count + rightBins[i].count - node->count;
+			if (left.count > 0 && rightBins[i].count > 0 && duplicatesCount <= this->duplicationBudget)
 			{
-				this->objectIndices[node->first + count] = bins[i][j];
-				count++;
+				float SAH = left.calculateSurfaceArea() * this->calculateLeafCost(left.count) + rightBins[i].calculateSurfaceArea() * this->calculateLeafCost(rightBins[i].count);
+				if (SAH < optimalSAH)
+				{
+					optimalSAH = SAH;
+					axis = a;
+					position = nodeMin[a] + i * binWidth;
+				}
 			}
+
+			left.merge(bins[i]);
+		}
+	}
+
+	return axis != -1;
+}
+
+void BVH::splitReferences(std::vector<Reference>& references, vec3 centerMin, vec3 centerMax, int binCount, int axis, int split, std::vector<Reference>& leftReferences, std::vector<Reference>& rightReferences)
+{
+	float binScale = binCount / (centerMax[axis] - centerMin[axis]);
+	for (int i = 0; i < references.size(); i++)
+	{
+		int binIndex = MIN(binCount - 1, (int)((references[i].bounds.center[axis] - centerMin[axis]) * binScale));
+
+		if (binIndex < split)
+		{
+			leftReferences.push_back(references[i]);
+		}
+		else
+		{
+			rightReferences.push_back(references[i]);
+		}
+	}
+}
+
+void BVH::splitReferencesSpatially(std::vector<Reference>& references, int axis, float position, std::vector<Reference>& leftReferences, std::vector<Reference>& rightReferences)
+{
+	Bin leftBin, rightBin;
+	leftBin.reset();
+	rightBin.reset();
+
+	// references on one side of the plane are kept whole
+	std::vector<int> straddling;
+	for (int i = 0; i < references.size(); i++)
+	{
+		if (references[i].bounds.max[axis] <= position)
+		{
+			leftReferences.push_back(references[i]);
+			leftBin.grow(references[i].bounds.min, references[i].bounds.max);
+			leftBin.count++;
+		}
+		else if (references[i].bounds.min[axis] >= position)
+		{
+			rightReferences.push_back(references[i]);
+			rightBin.grow(references[i].bounds.min, references[i].bounds.max);
+			rightBin.count++;
 		}
+		else
+		{
+			straddling.push_back(i);
+		}
+	}
 
-		// evaluate bin combinations
-		for (int i = 0; i < binCount - 1; i++)
+	// counts as if all straddling references were duplicated
+	leftBin.count += straddling.size();
+	rightBin.count += straddling.size();
+
+	for (int i = 0; i < straddling.size(); i++)
+	{
+		Reference& reference = references[straddling[i]];
+		Reference left, right;
+		this->splitReference(reference, axis, position, left, right);
+
+		// clipping can leave nothing of the object on one side of the plane
+		if (left.bounds.isEmpty() || right.bounds.isEmpty())
 		{
-			int leftCount = 0, rightCount = 0;
-			for (int j = 0; j <= i; j++)
+			if (left.bounds.isEmpty())
+			{
+				rightReferences.push_back(reference);
+				rightBin.grow(reference.bounds.min, reference.bounds.max);
+				leftBin.count--;
+			}
+			else
 			{
-				leftCount += bins[j].size();
+				leftReferences.push_back(reference);
+				leftBin.grow(reference.bounds.min, reference.bounds.max);
+				rightBin.count--;
 			}
-			rightCount = node->count - leftCount;
 
-			if (leftCount == 0 || rightCount == 0) continue;
+			continue;
+		}
+
+		// unsplitting, moving the whole reference into one child may be cheaper than duplicating it
+		Bin leftUnsplit = leftBin, rightUnsplit = rightBin;
+		leftUnsplit.grow(reference.bounds.min, reference.bounds.max);
+		rightUnsplit.grow(reference.bounds.min, reference.bounds.max);
+
+		Bin leftSplit = leftBin, rightSplit = rightBin;
+		leftSplit.grow(left.bounds.min, left.bounds.max);
+		rightSplit.grow(right.bounds.min, right.bounds.max);
+
+		float splitSAH = leftSplit.calculateSurfaceArea() * leftBin.count + rightSplit.calculateSurfaceArea() * rightBin.count;
+		float leftSAH = leftUnsplit.calculateSurfaceArea() * leftBin.count + rightBin.calculateSurfaceArea() * (rightBin.count - 1);
+		float rightSAH = leftBin.calculateSurfaceArea() * (leftBin.count - 1) + rightUnsplit.calculateSurfaceArea() * rightBin.count;
+
+		// once the budget is spent the references can only be unsplit, the node arrays have no room for more
+		bool duplicate = this->duplicationBudget > 0 && splitSAH <= MIN(leftSAH, rightSAH);
+		if (!duplicate && leftSAH <= rightSAH)
+		{
+			leftReferences.push_back(reference);
+			leftBin = leftUnsplit;
+			rightBin.count--;
+		}
+		else if (!duplicate)
+		{
+			rightReferences.push_back(reference);
+			rightBin = rightUnsplit;
+			leftBin.count--;
+		}
+		else
+		{
+			leftReferences.push_back(left);
+			rightReferences.push_back(right);
+			leftBin = leftSplit;
+			rightBin = rightSplit;
+			this->duplicationBudget--;
+		}
+	}
+}
+
+void BVH::splitReference(const Reference& reference, int axis, float position, Reference& left, Reference& right)
+{
+	left.index = reference.index;
+	right.index = reference.index;
+
+	if (this->mesh != NULL)
+	{
+		this->mesh->clip(reference.index, reference.bounds, axis, position, left.bounds, right.bounds);
+	}
+	else
+	{
+		this->primitives[reference.index]->clip(reference.bounds, axis, position, left.bounds, right.bounds);
+	}
+}
+
+// -------------------- LINEAR BUILD ------------------------------------
+
+// spreads the lower 10 bits of a value over every third bit
+static unsigned int expandBits(unsigned int value)
+{
+	value = (value * 0x00010001u) & 0xFF0000FFu;
+	value = (value * 0x00000101u) & 0x0F00F00Fu;
+	value = (value * 0x00000011u) & 0xC30C30C3u;
+	value = (value * 0x00000005u) & 0x49249249u;
+
+	return value;
+}
+
+void BVH::subdivideLinear(BVHNode* root)
+{
+	int first = root->leftFirst, count = root->count;
+
+	this->calculateMortonCodes(first, count);
+	this->sortMortonCodes();
+
+	// objects along the Morton curve, neighbouring objects end up in the same subtrees
+	for (int i = 0; i < count; i++)
+	{
+		this->objectIndices[first + i] = this->mortonPrimitives[i].index;
+	}
+
+	this->emitHierarchy(root, 0, count, 3 * MORTON_BITS - 1);
+
+	if (LBVH_ROTATIONS)
+	{
+		this->rotate(root);
+	}
+
+	std::vector<MortonPrimitive>().swap(this->mortonPrimitives);
+}
+
+void BVH::calculateMortonCodes(int first, int count)
+{
+	vec3 centerMin, centerMax;
+	this->calculateCenterBounds(first, count, centerMin, centerMax);
+
+	// quantize the centers within their bounds
+	const float cells = (float)((1 << MORTON_BITS) - 1);
+	vec3 extent = centerMax - centerMin;
+	vec3 scale = vec3(
+		extent.x > 0 ? cells / extent.x : 0,
+		extent.y > 0 ? cells / extent.y : 0,
+		extent.z > 0 ? cells / extent.z : 0
+	);
+
+	this->mortonPrimitives.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		int index = this->objectIndices[first + i];
+		vec3 cell = (this->boundingBoxes[index]->center - centerMin) * scale;
+
+		this->mortonPrimitives[i].index = index;
+		this->mortonPrimitives[i].code = (expandBits((unsigned int)cell.x) << 2) | (expandBits((unsigned int)cell.y) << 1) | expandBits((unsigned int)cell.z);
+	}
+}
 
-			node->left->first = node->first;
-			node->left->count = leftCount;
-			calculateBounds(node->left);
+void BVH::sortMortonCodes()
+{
+	const int digitsCount = 1 << RADIX_BITS;
+	int count = this->mortonPrimitives.size();
+
+	// LSD radix sort, large models sort chunks of the codes in parallel
+	JobManager* jobManager = JobManager::GetJobManager();
+	bool parallel = MULTITHREADING_ENABLED && jobManager && count >= PARALLEL_BUILD_THRESHOLD;
+	int chunksCount = parallel ? jobManager->GetNumThreads() : 1;
+	int chunkSize = (count + chunksCount - 1) / chunksCount;
 
-			node->right->first = node->first + leftCount;
-			node->right->count = rightCount;
-			calculateBounds(node->right);
+	std::vector<MortonPrimitive> buffer(count);
+	MortonPrimitive* source = &this->mortonPrimitives[0];
+	MortonPrimitive* destination = &buffer[0];
 
-			// calculate surface area
-			float surfaceAreaLeft = node->left->boundingBox->calculateSurfaceArea();
-			float surfaceAreaRight = node->right->boundingBox->calculateSurfaceArea();
-			float SAH = surfaceAreaLeft * node->left->count + surfaceAreaRight * node->right->count;
+	std::vector<MortonSortJob> jobs(chunksCount);
+	unsigned int* offsets = new unsigned int[chunksCount * digitsCount];
+	for (int i = 0; i < chunksCount; i++)
+	{
+		jobs[i].first = i * chunkSize;
+		jobs[i].count = MAX(0, MIN(chunkSize, count - i * chunkSize));
+		jobs[i].offsets = &offsets[i * digitsCount];
+	}
 
-			// save the optimal split according Surface Area Heuristic
-			if (SAH < optimalSAH && SAH < (surfaceAreaLeft + surfaceAreaRight) * node->count)
+	for (int shift = 0; shift < 3 * MORTON_BITS; shift += RADIX_BITS)
+	{
+		for (int pass = 0; pass < 2; pass++)
+		{
+			for (int i = 0; i < chunksCount; i++)
 			{
-				optimalSAH = SAH;
-				optimalLeftCount = leftCount;
-				optimalRightCount = rightCount;
+				jobs[i].shift = shift;
+				jobs[i].scatter = pass == 1;
+				jobs[i].source = source;
+				jobs[i].destination = destination;
+
+				if (parallel) jobManager->AddJob2(&jobs[i]);
+				else jobs[i].Main();
+			}
+			if (parallel) jobManager->RunJobs();
 
-				for (int j = 0; j < node->count; j++)
+			if (pass == 0)
+			{
+				// turn the digit counts into offsets, chunks of the same digit stay in order so the sort is stable
+				unsigned int offset = 0;
+				for (int digit = 0; digit < digitsCount; digit++)
 				{
-					optimalObjectIndices[j] = this->objectIndices[node->first + j];
+					for (int i = 0; i < chunksCount; i++)
+					{
+						unsigned int digitCount = jobs[i].offsets[digit];
+						jobs[i].offsets[digit] = offset;
+						offset += digitCount;
+					}
 				}
 			}
 		}
+
+		swap(source, destination);
 	}
-	delete[] bins;
 
-	// set optimal split values
-	for (int i = 0; i < node->count; i++)
+	if (source != &this->mortonPrimitives[0])
 	{
-		this->objectIndices[node->first + i] = optimalObjectIndices[i];
+		this->mortonPrimitives.swap(buffer);
 	}
 
-	node->left->first = node->first;
-	node->left->count = optimalLeftCount;
-	calculateBounds(node->left);
+	delete[] offsets;
+}
+
+void BVH::emitHierarchy(BVHNode* node, int first, int count, int bit)
+{
+	// first indexes the sorted codes, the object indices of the node start at the same offset from the root
+	int rootFirst = this->startIndex;
+
+	if (count <= this->leafSize)
+	{
+		node->leftFirst = rootFirst + first;
+		node->count = count;
+		this->calculateBounds(node);
+
+		return;
+	}
+
+	// skip the bits all codes of the node share, codes are sorted so comparing the outer ones is enough
+	unsigned int firstCode = this->mortonPrimitives[first].code, lastCode = this->mortonPrimitives[first + count - 1].code;
+	while (bit >= 0 && ((firstCode ^ lastCode) & (1u << bit)) == 0)
+	{
+		bit--;
+	}
+
+	int split;
+	if (bit < 0)
+	{
+		// identical codes, split in the middle
+		split = first + count / 2;
+	}
+	else
+	{
+		// binary search for the first code with the bit set
+		int low = first, high = first + count - 1;
+		while (low < high)
+		{
+			int middle = (low + high) / 2;
+			if (this->mortonPrimitives[middle].code & (1u << bit)) high = middle;
+			else low = middle + 1;
+		}
+		split = low;
+	}
+
+	int leftIndex = this->buildNodesUsed.fetch_add(2);
+	assert(leftIndex + 1 < this->buildNodesCount);
+	BVHNode* left = &this->buildNodes[leftIndex];
+	BVHNode* right = &this->buildNodes[leftIndex + 1];
+
+	this->emitHierarchy(left, first, split - first, bit - 1);
+	this->emitHierarchy(right, split, first + count - split, bit - 1);
+
+	node->setBounds(left, right);
+	node->leftFirst = leftIndex;
+	node->count = 0;
+}
+
+void BVH::rotate(BVHNode* node)
+{
+	if (node->isLeaf())
+	{
+		return;
+	}
+
+	this->rotate(&this->buildNodes[node->leftFirst]);
+	this->rotate(&this->buildNodes[node->leftFirst + 1]);
+
+	// swapping a child with one of the children of its sibling only changes the surface area of that sibling
+	float optimalSurfaceArea = INFINITY;
+	BVHNode* optimalChild = NULL;
+	BVHNode* optimalGrandchild = NULL;
+	BVHNode* optimalSibling = NULL;
+	for (int i = 0; i < 2; i++)
+	{
+		BVHNode* child = &this->buildNodes[node->leftFirst + i];
+		BVHNode* sibling = &this->buildNodes[node->leftFirst + 1 - i];
+		if (sibling->isLeaf()) continue;
+
+		for (int j = 0; j < 2; j++)
+		{
+			BVHNode* grandchild = &this->buildNodes[sibling->leftFirst + j];
+			BVHNode* remaining = &this->buildNodes[sibling->leftFirst + 1 - j];
+
+			Bin rotated;
+			rotated.reset();
+			rotated.grow(child->getMin(), child->getMax());
+			rotated.grow(remaining->getMin(), remaining->getMax());
+
+			float surfaceArea = rotated.calculateSurfaceArea() - sibling->calculateSurfaceArea();
+			if (surfaceArea < 0 && surfaceArea < optimalSurfaceArea)
+			{
+				optimalSurfaceArea = surfaceArea;
+				optimalChild = child;
+				optimalGrandchild = grandchild;
+				optimalSibling = sibling;
+			}
+		}
+	}
+
+	if (optimalChild == NULL)
+	{
+		return;
+	}
 
-	node->right->first = node->first + optimalLeftCount;
-	node->right->count = optimalRightCount;
-	calculateBounds(node->right);
+	// whole subtrees are swapped by swapping their roots
+	BVHNode temporary = *optimalChild;
+	*optimalChild = *optimalGrandchild;
+	*optimalGrandchild = temporary;
 
-	delete optimalObjectIndices;
+	optimalSibling->setBounds(&this->buildNodes[optimalSibling->leftFirst], &this->buildNodes[optimalSibling->leftFirst + 1]);
 }
@@ -4,20 +4,156 @@ namespace Tmpl8
 	class BVH
 	{
 	public:
-		BVH(std::vector<Primitive*> primitives);
+		BVH(std::vector<Primitive*> primitives, TriangleMesh* mesh = NULL);
+		virtual ~BVH();
 
-		BVHNode* root;
+		BVHNode* nodes; // depth-first node array, root at index 0
+		int nodesUsed;
+		int nodesAllocated; // builds allocate for the largest possible tree
 		int id;
+		int startIndex, endIndex; // range of the primitives of this BVH in the scene, or of the triangles of its mesh
 		int* objectIndices;
+		int objectIndicesCount;
+		TriangleMesh* mesh; // objects are triangles of this mesh instead of primitives when set
+		BVH4* bvh4; // wide versions of the tree, built according to BVH_WIDTH
+		BVH8* bvh8;
 
-		void build(int id, int startIndex, int endIndex);
+		// mesh triangles of every leaf packed for SIMD tests according to TRIANGLE_PACKET_WIDTH,
+		// packetIndices maps the first object index of a leaf to its first packet
+		TrianglePacket4* packets4;
+		TrianglePacket8* packets8;
+		int packetsCount;
+		int* packetIndices;
+
+		// copies of the primitives of every leaf grouped by type, primitiveReferences holds the reference
+		// of every entry of objectIndices for a switch dispatch instead of virtual calls
+		PrimitiveArrays* primitiveArrays;
+		int* primitiveReferences;
+
+		// statistics of the last build
+		BVHBuildMode buildMode;
+		int objectsCount;
+		int referencesCount; // exceeds the objects count when spatial splits duplicated objects
+		float SAHCost;
+		float buildTime; // milliseconds, including the wide nodes, packets and primitive groups
+
+		void build(int id, int startIndex, int endIndex, BVHBuildMode buildMode = binnedSAH);
+		void rebuild();
+		void translate(vec3 vector);
+		void printReport(const char* name);
+		size_t calculateMemoryUsage(); // bytes of the nodes, wide nodes, packets, primitive copies and index arrays
+
+		struct Bin
+		{
+			vec3 min, max;
+			int count;
+
+			void reset();
+			void grow(vec3 min, vec3 max);
+			void merge(const Bin& bin);
+			float calculateSurfaceArea();
+		};
+
+		struct MortonPrimitive
+		{
+			unsigned int code;
+			int index;
+		};
 
 	protected:
+		friend class BVHBinningJob;
+		friend class BVHSubdivisionJob;
+		friend class MeshCache;
+
+
 		std::vector<Primitive*> primitives;
 		std::vector<BoundingBox*> boundingBoxes;
+		int leafSize; // nodes with at most this many objects become leaves without evaluating splits
 
+		// during the build children are allocated in pairs, from several threads for large trees
+		BVHNode* buildNodes;
+		int buildNodesCount;
+		std::atomic<int> buildNodesUsed;
+
+		// object reference of the spatial split builder, bounds only cover the part of the object within its node
+		struct Reference
+		{
+			int index;
+			BoundingBox bounds;
+		};
+		std::vector<int> leafReferences;
+		float rootSurfaceArea;
+		int duplicationBudget;
+		int spatialSplitsCount;
+
+		// codes of the linear builder, sorted along with the object indices of the model
+		std::vector<MortonPrimitive> mortonPrimitives;
+
+		void allocateNodes(int objectCount);
 		void calculateBounds(BVHNode* node);
 		void subdivide(BVHNode* node, int depth);
-		void partition(BVHNode* node, int binCount);
+		void subdivideParallel(BVHNode* root);
+		int flatten(BVHNode* buildNode);
+
+		bool partition(BVHNode* node, BVHNode* left, BVHNode* right, int binCount);
+		bool partitionParallel(BVHNode* node, BVHNode* left, BVHNode* right, int binCount);
+		void calculateCenterBounds(int first, int count, vec3& centerMin, vec3& centerMax);
+		void binObjects(int first, int count, vec3 centerMin, vec3 centerMax, int binCount, Bin* bins);
+		bool findOptimalSplit(BVHNode* node, vec3 centerMin, vec3 centerMax, int binCount, Bin* bins, int& axis, int& split, Bin& leftBin, Bin& rightBin);
+		void splitObjects(BVHNode* node, BVHNode* left, BVHNode* right, vec3 centerMin, vec3 centerMax, int binCount, int axis, int split, Bin& leftBin, Bin& rightBin);
+
+		void subdivideSpatial(BVHNode* node, std::vector<Reference>& references, int depth);
+		void calculateBounds(BVHNode* node, std::vector<Reference>& references);
+		bool findSpatialSplit(BVHNode* node, std::vector<Reference>& references, int binCount, float& optimalSAH, int& axis, float& position);
+		void splitReferences(std::vector<Reference>& references, vec3 centerMin, vec3 centerMax, int binCount, int axis, int split, std::vector<Reference>& leftReferences, std::vector<Reference>& rightReferences);
+		void splitReferencesSpatially(std::vector<Reference>& references, int axis, float position, std::vector<Reference>& leftReferences, std::vector<Reference>& rightReferences);
+		void splitReference(const Reference& reference, int axis, float position, Reference& left, Reference& right);
+		float calculateSAHCost();
+		int calculateLeafCost(int count);
+		template <class Packet> Packet* packTriangles();
+		void groupPrimitives();
+
+		void subdivideLinear(BVHNode* root);
+		void calculateMortonCodes(int first, int count);
+		void sortMortonCodes();
+		void emitHierarchy(BVHNode* node, int first, int count, int bit);
+		void rotate(BVHNode* node);
+	};
+
+	// calculates the center bounds or the bins of one chunk of the objects of a node
+	class BVHBinningJob : public Job
+	{
+	public:
+		void Main();
+
+		BVH* bvh;
+		int first, count, binCount;
+		bool calculateCenterBounds;
+		vec3 centerMin, centerMax;
+		BVH::Bin* bins;
+	};
+
+	// builds a whole subtree of a large BVH on one thread
+	class BVHSubdivisionJob : public Job
+	{
+	public:
+		void Main();
+
+		BVH* bvh;
+		BVHNode* node;
+		int depth;
+	};
+
+	// one pass of the radix sort of Morton codes over one chunk, either counting digits or scattering by them
+	class MortonSortJob : public Job
+	{
+	public:
+		void Main();
+
+		int first, count, shift;
+		bool scatter;
+		unsigned int* offsets;
+		BVH::MortonPrimitive* source;
+		BVH::MortonPrimitive* destination;
 	};
 }
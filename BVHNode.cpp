@@ -1,23 +1,46 @@
 #include "precomp.h"
 
-BVHNode::BVHNode()
+void BVHNode::setBounds(vec3 min, vec3 max)
 {
-	this->isLeaf = false;
-	this->boundingBox = new BoundingBox();
+	this->minX = min.x;
+	this->minY = min.y;
+	this->minZ = min.z;
+
+	this->maxX = max.x;
+	this->maxY = max.y;
+	this->maxZ = max.z;
+}
+
+void BVHNode::setBounds(BVHNode* left, BVHNode* right)
+{
+	this->minX = MIN(left->minX, right->minX);
+	this->minY = MIN(left->minY, right->minY);
+	this->minZ = MIN(left->minZ, right->minZ);
+
+	this->maxX = MAX(left->maxX, right->maxX);
+	this->maxY = MAX(left->maxY, right->maxY);
+	this->maxZ = MAX(left->maxZ, right->maxZ);
+}
+
+float BVHNode::calculateSurfaceArea()
+{
+	vec3 diagonal = (this->getMax() - this->getMin()).absolute();
+
+	return ((diagonal.x * diagonal.y) + (diagonal.x * diagonal.z) + (diagonal.z * diagonal.y)) * 2;
 }
 
-bool BVHNode::intersects(Ray* ray)
+bool BVHNode::intersects(Ray* ray, float& entryDistance)
 {
 	float tmin, tmax, txmin, txmax, tymin, tymax, tzmin, tzmax;
 
-	txmin = (this->boundingBox->min.x - ray->origin.x) * ray->invertedDirection.x;
-	txmax = (this->boundingBox->max.x - ray->origin.x) * ray->invertedDirection.x;
+	txmin = (this->minX - ray->origin.x) * ray->invertedDirection.x;
+	txmax = (this->maxX - ray->origin.x) * ray->invertedDirection.x;
 
-	tymin = (this->boundingBox->min.y - ray->origin.y) * ray->invertedDirection.y;
-	tymax = (this->boundingBox->max.y - ray->origin.y) * ray->invertedDirection.y;
+	tymin = (this->minY - ray->origin.y) * ray->invertedDirection.y;
+	tymax = (this->maxY - ray->origin.y) * ray->invertedDirection.y;
 
-	tzmin = (this->boundingBox->min.z - ray->origin.z) * ray->invertedDirection.z;
-	tzmax = (this->boundingBox->max.z - ray->origin.z) * ray->invertedDirection.z;
+	tzmin = (this->minZ - ray->origin.z) * ray->invertedDirection.z;
+	tzmax = (this->maxZ - ray->origin.z) * ray->invertedDirection.z;
 
 	tmin = min(txmin, txmax);
 	tmax = max(txmin, txmax);
@@ -32,32 +55,12 @@ bool BVHNode::intersects(Ray* ray)
 	if (tmin > ray->t)
 		return false;
 
+	entryDistance = tmin;
+
 	return tmax >= tmin && tmax >= 0;
 }
 
 void BVHNode::translate(vec3 vector)
 {
-	this->boundingBox->translate(vector);
-
-	if (this->isLeaf) return;
-
-	this->left->translate(vector);
-	this->right->translate(vector);
+	this->setBounds(this->getMin() + vector, this->getMax() + vector);
 }
-
-void BVHNode::destroy()
-{
-	if (this->isLeaf)
-	{
-		delete this->boundingBox;
-		delete this;
-
-		return;
-	}
-
-	this->left->destroy();
-	this->right->destroy();
-
-	delete this->boundingBox;
-	delete this;
-}
\ No newline at end of file
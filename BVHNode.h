@@ -1,20 +1,23 @@
 #pragma once
 namespace Tmpl8
 {
-	class BVHNode
+	// 32-byte node, stored in the flat depth-first node array of its BVH.
+	// Interior nodes (count == 0): the left child directly follows its parent, leftFirst is the index of the right child.
+	// Leaves (count > 0): leftFirst is the index of the first object in the objectIndices array of the BVH.
+	class alignas(32) BVHNode
 	{
 	public:
-		BVHNode();
+		union { struct { float minX, minY, minZ; int leftFirst; }; __m128 min4; };
+		union { struct { float maxX, maxY, maxZ; int count; }; __m128 max4; };
 
-		BoundingBox* boundingBox;
-		bool isLeaf;
-		BVHNode *left, *right;
-		int first, count;
+		bool isLeaf() const { return this->count > 0; }
+		vec3 getMin() const { return vec3(this->minX, this->minY, this->minZ); }
+		vec3 getMax() const { return vec3(this->maxX, this->maxY, this->maxZ); }
 
-		bool intersects(Ray* ray);
+		void setBounds(vec3 min, vec3 max);
+		void setBounds(BVHNode* left, BVHNode* right);
+		float calculateSurfaceArea();
+		bool intersects(Ray* ray, float& entryDistance);
 		void translate(vec3 vector);
-		void destroy();
-	private:
 	};
 }
-
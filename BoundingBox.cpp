@@ -32,3 +32,8 @@ float BoundingBox::calculateSurfaceArea()
 	return ((diagonal.x * diagonal.y) + (diagonal.x * diagonal.z) + (diagonal.z * diagonal.y)) * 2;
 }
 
+
+bool BoundingBox::isEmpty() const
+{
+	return this->min.x > this->max.x || this->min.y > this->max.y || this->min.z > this->max.z;
+}
@@ -12,5 +12,6 @@ namespace Tmpl8
 		void calculateCenter();
 		void translate(vec3 vector);
 		float calculateSurfaceArea();
+		bool isEmpty() const;
 	};
 }
@@ -0,0 +1,246 @@
+#include "precomp.h"
+
+void DemoScenes::loadSimple(Scene* scene)
+{
+	scene->clear();
+	scene->beginBatch();
+	scene->camera->reset();
+
+	scene->camera->position = vec3(0, 11, -67);
+	scene->camera->up = vec3(0, 0.9, 0.15);
+	scene->camera->right = vec3(0.9, 0, 0);
+	scene->camera->calculateScreen();
+
+	scene->loadSkydome("assets/skydome/space.hdr");
+
+	// lights
+	scene->addLightSource(new SphericalLight(vec3(-5, 40, -20), 4, vec4(1, 1, 1, 1), 25));
+
+	// materials
+	Material* floorMaterial = new Material(vec4(0.5, 0.5, 0.5, 1.0), diffuse);
+	Material* wallMaterial = new Material(vec4(0.5, 0.5, 0.5, 1.0), diffuse);
+
+	Material* redMaterial = new Material(vec4(0.8, 0.21, 0.19, 1), diffuse);
+	Material* mirrorMaterial = new Material(vec4(0.75, 0.8, 0.7, 1), mirror);
+
+	Material* glassMaterial = new Material(vec4(0.25, 0.75, 0.25, 1), dielectric);
+	glassMaterial->refraction = 1.33;
+	glassMaterial->reflection = 0.5;
+
+	// room
+	int roomWidth = 50;
+	int roomHeigth = 50;
+
+	// floor
+	scene->addPrimitive(new Plane(floorMaterial, vec3(roomWidth, -10, 10), vec3(0, 1, 0), 100));
+
+	scene->addPrimitive(new Sphere(mirrorMaterial, vec3(-5, 0, -10), 5));
+	scene->addPrimitive(new Sphere(redMaterial, vec3(-5, 0, -20), 4));
+	scene->addPrimitive(new Sphere(glassMaterial, vec3(-5, -5, -30), 5));
+
+	scene->commitBatch();
+}
+
+void DemoScenes::loadNice(Scene* scene)
+{
+	// https://groups.csail.mit.edu/graphics/classes/6.837/F03/models/
+	//movingModelId = scene->loadModel("assets/cube.obj", brownMaterial);
+
+	// reset scene
+	scene->clear();
+	scene->beginBatch();
+	scene->camera->reset();
+
+	scene->camera->position = vec3(0, 15, -90);
+	scene->camera->up = vec3(0, 0.9, 0.15);
+	scene->camera->right = vec3(1, 0, 0);
+	scene->camera->calculateScreen();
+
+	scene->loadSkydome("assets/skydome/space.hdr");
+
+	// scene lights
+	scene->addLightSource(new SphericalLight(vec3(-5, 30, -20), 2, vec4(1, 1, 1, 1), 125));
+	scene->addLightSource(new SphericalLight(vec3(15, 30, -20), 1, vec4(1, 1, 1, 1), 100));
+	scene->addLightSource(new SphericalLight(vec3(0, -10, -20), 2, vec4(0.85, 0.83, 0.12, 1), 25));
+
+	// materials
+	Material* floorMaterial = new Material(vec4(0.5, 0.5, 0.5, 1.0), diffuse);
+	Material* whiteMaterial = new Material(vec4(1, 1, 1, 1), diffuse);
+	Material* wallMaterial = new Material(vec4(0.09, 0.63, 0.52, 1), diffuse);
+
+	Material* glassMaterial = new Material(vec4(0.78, 0.85, 0.86, 1), dielectric);
+	glassMaterial->refraction = 1.33;
+	glassMaterial->reflection = 0.5;
+
+	Material* redGlassMaterial = new Material(vec4(1, 0.25, 0.25, 1), dielectric);
+	redGlassMaterial->refraction = 1.33;
+	redGlassMaterial->reflection = 0.5;
+
+	Material* mirrorMaterial = new Material(vec4(0.75, 0.8, 0.7, 1), mirror);
+	Material* orangeMaterial = new Material(vec4(0.95, 0.61, 0.07, 1), diffuse);
+	Material* redMaterial = new Material(vec4(0.8, 0.21, 0.19, 1), diffuse);
+
+	int roomWidth = 50;
+	int roomHeigth = 10;
+
+	// floor
+	//scene->addPrimitive(new Triangle(floorMaterial, vec3(-roomWidth, -10, -100), vec3(-roomWidth, -10, 10), vec3(roomWidth, -10, 10)));
+	//scene->addPrimitive(new Triangle(floorMaterial, vec3(roomWidth, -10, -100), vec3(-roomWidth, -10, -100), vec3(roomWidth, -10, 10)));
+	scene->addPrimitive(new Plane(floorMaterial, vec3(roomWidth, -10, 10), vec3(0, 1, 0), 100));
+	
+	// walls
+	scene->addPrimitive(new Triangle(mirrorMaterial, vec3(roomWidth, -roomHeigth, 10), vec3(-roomWidth, -roomHeigth, 10), vec3(roomWidth, roomHeigth, 10)));
+	scene->addPrimitive(new Triangle(mirrorMaterial, vec3(-roomWidth, -roomHeigth, 10), vec3(-roomWidth, roomHeigth, 10), vec3(roomWidth, roomHeigth, 10)));
+
+	/*scene->addPrimitive(new Triangle(wallMaterial, vec3(roomWidth, -roomHeigth, -100), vec3(roomWidth, -roomHeigth, 10), vec3(roomWidth, roomHeigth, 10)));
+	scene->addPrimitive(new Triangle(wallMaterial, vec3(roomWidth, roomHeigth, -100), vec3(roomWidth, -roomHeigth, -100), vec3(roomWidth, roomHeigth, 10)));
+
+	scene->addPrimitive(new Triangle(wallMaterial, vec3(-roomWidth, -roomHeigth, 10), vec3(-roomWidth, -roomHeigth, -100), vec3(-roomWidth, roomHeigth, 10)));
+	scene->addPrimitive(new Triangle(wallMaterial, vec3(-roomWidth, -roomHeigth, -100), vec3(-roomWidth, roomHeigth, -100), vec3(-roomWidth, roomHeigth, 10)));
+
+	scene->addPrimitive(new Triangle(wallMaterial, vec3(-roomWidth, -roomHeigth, -100), vec3(roomWidth, -roomHeigth, -100), vec3(roomWidth, roomHeigth, -100)));
+	scene->addPrimitive(new Triangle(wallMaterial, vec3(-roomWidth, roomHeigth, -100), vec3(-roomWidth, -roomHeigth, -100), vec3(roomWidth, roomHeigth, -100)));
+	//*/
+
+	// teapots
+	Material* purpleMaterial = new Material(vec4(0.67, 0.37, 0.87, 0), diffuse);
+
+	scene->loadModel("assets/teapot.obj", purpleMaterial, vec3(-10, -7, -40));
+	scene->addPrimitive(new Sphere(whiteMaterial, vec3(-10, -12, -40), 5));
+
+	scene->loadModel("assets/teapot.obj", redGlassMaterial, vec3(EPSILON, -10, -50));
+
+	scene->loadModel("assets/teapot.obj", purpleMaterial, vec3(10, -7, -40));
+	scene->addPrimitive(new Sphere(whiteMaterial, vec3(10, -12, -40), 5));
+
+	// sphere with torus
+	scene->addPrimitive(new Sphere(redMaterial, vec3(0, 0, -10), 5));
+	scene->addPrimitive(new Torus(orangeMaterial, 7, 1, vec3(0, 0, -10), vec3(-1, -1.5, 0)));
+
+	// cylinders
+	scene->addPrimitive(new Cylinder(redMaterial, vec3(-10, -10, -20), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(glassMaterial, vec3(-13, -10, -22), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(redMaterial, vec3(-16, -10, -24), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(glassMaterial, vec3(-19, -10, -26), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(redMaterial, vec3(-22, -10, -28), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(glassMaterial, vec3(-25, -10, -30), vec3(0, 1, 0), 0.5, 30));
+
+	scene->addPrimitive(new Cylinder(redMaterial, vec3(10, -10, -20), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(glassMaterial, vec3(13, -10, -22), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(redMaterial, vec3(16, -10, -24), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(glassMaterial, vec3(19, -10, -26), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(redMaterial, vec3(22, -10, -28), vec3(0, 1, 0), 0.5, 30));
+	scene->addPrimitive(new Cylinder(glassMaterial, vec3(25, -10, -30), vec3(0, 1, 0), 0.5, 30));
+
+	scene->commitBatch();
+}
+
+void DemoScenes::loadTeddy(Scene* scene)
+{
+	scene->clear();
+	scene->beginBatch();
+
+	scene->camera->reset();
+	scene->camera->position = vec3(-32, 0, 40);
+	scene->camera->up = vec3(0, 1, 0);
+	scene->camera->right = vec3(-0.77, 0, -0.62);
+	scene->camera->calculateScreen();
+
+	scene->loadSkydome("assets/skydome/space.hdr");
+
+	scene->addLightSource(new DirectLight(vec3(-10.0f, 0.0f, 20.0), vec4(1, 1, 1, 0), 250));
+
+	Material* redMaterial = new Material(vec4(1, 0, 0, 0), diffuse);
+	scene->addPrimitive(
+		new Sphere(redMaterial, vec3(-25, 10, 0), 5)
+	);
+
+	Material* brownMaterial = new Material(vec4(1, 0.8, 0.5, 0), diffuse);
+	for (int i = 0; i < 3; i++)
+	{
+		scene->loadModel("assets/teddy.obj", brownMaterial, vec3(i * 40, 0, 0));
+	}
+
+	scene->commitBatch();
+}
+
+void DemoScenes::loadTeapot(Scene* scene)
+{
+	scene->clear();
+	scene->beginBatch();
+
+	scene->camera->reset();
+	scene->camera->position = vec3(-20, -0.013, 20);
+	scene->camera->up = vec3(0, 1, 0);
+	scene->camera->right = vec3(-0.921, 0, -0.387);
+	scene->camera->calculateScreen();
+
+	scene->loadSkydome("assets/skydome/space.hdr");
+
+	scene->addLightSource(new DirectLight(vec3(-10.0f, 0.0f, 20.0), vec4(1, 1, 1, 0), 250));
+
+	Material* brownMaterial = new Material(vec4(1, 0.8, 0.5, 0), diffuse);
+	for (int i = 0; i < 10; i++)
+	{
+		scene->loadModel("assets/teapot.obj", brownMaterial, vec3(i * 7, 0, 0));
+	}
+
+	scene->commitBatch();
+}
+
+void DemoScenes::loadCow(Scene* scene)
+{
+	scene->clear();
+	scene->beginBatch();
+
+	scene->camera->reset();
+	scene->camera->position = vec3(0.8f, 1.5f, -11);
+	scene->camera->viewDirection = vec3(0.8f, -0.4f, 0);
+	scene->camera->up = vec3(0, 1, 0);
+	scene->camera->calculateScreen();
+
+	scene->addLightSource(new SphericalLight(vec3(5, 15, -10), 2, vec4(1, 1, 1, 1), 10));
+
+	Material* floorMaterial = new Material(vec4(0.5, 0.5, 0.5, 1.0), diffuse);
+	Material* cowMaterial = new Material(vec4(0.8, 0.75, 0.7, 1), diffuse);
+
+	scene->addPrimitive(new Plane(floorMaterial, vec3(0, -3.64f, 0), vec3(0, 1, 0), 100));
+	scene->loadModel("assets/cow.obj", cowMaterial);
+
+	scene->commitBatch();
+}
+
+void DemoScenes::loadPumpkin(Scene* scene)
+{
+	scene->clear();
+	scene->beginBatch();
+
+	scene->camera->reset();
+	scene->camera->position = vec3(-2.6f, 20, -25);
+	scene->camera->viewDirection = vec3(-2.6f, 0.9f, -110);
+	scene->camera->up = vec3(0, 1, 0);
+	scene->camera->calculateScreen();
+
+	scene->addLightSource(new SphericalLight(vec3(-2.6f, 80, -60), 5, vec4(1, 1, 1, 1), 120));
+
+	Material* floorMaterial = new Material(vec4(0.5, 0.5, 0.5, 1.0), diffuse);
+	Material* pumpkinMaterial = new Material(vec4(0.95, 0.61, 0.07, 1), diffuse);
+
+	scene->addPrimitive(new Plane(floorMaterial, vec3(0, -37.6f, -110), vec3(0, 1, 0), 200));
+	scene->loadModel("assets/pumpkin.obj", pumpkinMaterial);
+
+	scene->commitBatch();
+}
+
+bool DemoScenes::load(Scene* scene, const char* name)
+{
+	if (!strcmp(name, "simple")) DemoScenes::loadSimple(scene);
+	else if (!strcmp(name, "nice")) DemoScenes::loadNice(scene);
+	else if (!strcmp(name, "teddy")) DemoScenes::loadTeddy(scene);
+	else if (!strcmp(name, "teapot")) DemoScenes::loadTeapot(scene);
+	else if (!strcmp(name, "cow")) DemoScenes::loadCow(scene);
+	else if (!strcmp(name, "pumpkin")) DemoScenes::loadPumpkin(scene);
+	else return false;
+
+	return true;
+}
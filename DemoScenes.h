@@ -0,0 +1,17 @@
+#pragma once
+namespace Tmpl8
+{
+	// the scenes of the game, shared with the headless renderer
+	class DemoScenes
+	{
+	public:
+		static void loadSimple(Scene* scene);
+		static void loadNice(Scene* scene);
+		static void loadTeddy(Scene* scene);
+		static void loadTeapot(Scene* scene);
+		static void loadCow(Scene* scene);
+		static void loadPumpkin(Scene* scene);
+
+		static bool load(Scene* scene, const char* name); // simple, nice, teddy, teapot, cow or pumpkin, false for unknown names
+	};
+}
@@ -1,5 +1,7 @@
 #include "precomp.h"
 
+#ifndef HEADLESS
+
 HDRBitmap::HDRBitmap(const char* fileName)
 {
 	FIBITMAP* dib = FreeImage_Load(FIF_HDR, fileName);
@@ -23,3 +25,97 @@ HDRBitmap::HDRBitmap(const char* fileName)
 		}
 	}
 }
+
+#else
+
+// reads one scanline of RGBE pixels, either run length encoded per component or flat
+static bool readScanline(FILE* file, int width, unsigned char* scanline)
+{
+	unsigned char header[4];
+	if (fread(header, 1, 4, file) != 4) return false;
+
+	if (header[0] != 2 || header[1] != 2 || (header[2] & 0x80) || width < 8 || width > 0x7fff)
+	{
+		memcpy(scanline, header, 4);
+		return fread(scanline + 4, 4, width - 1, file) == (size_t)(width - 1);
+	}
+
+	for (int component = 0; component < 4; component++)
+	{
+		for (int x = 0; x < width;)
+		{
+			int count = fgetc(file);
+			if (count == EOF) return false;
+
+			if (count > 128)
+			{
+				count -= 128;
+				int value = fgetc(file);
+				if (value == EOF || x + count > width) return false;
+				for (int i = 0; i < count; i++, x++) scanline[x * 4 + component] = value;
+			}
+			else
+			{
+				if (count == 0 || x + count > width) return false;
+				for (int i = 0; i < count; i++, x++)
+				{
+					int value = fgetc(file);
+					if (value == EOF) return false;
+					scanline[x * 4 + component] = value;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// headless builds read Radiance files themselves instead of through FreeImage. Rows are stored top to bottom
+// like the FreeImage version, only the standard -Y height +X width orientation is supported.
+HDRBitmap::HDRBitmap(const char* fileName)
+{
+	this->width = this->height = 0;
+	this->buffer = NULL;
+
+	FILE* file = fopen(fileName, "rb");
+	if (!file)
+	{
+		printf("Could not open %s\n", fileName);
+		return;
+	}
+
+	char line[256];
+	while (fgets(line, sizeof(line), file) && line[0] != '\n');
+
+	if (!fgets(line, sizeof(line), file) || sscanf(line, "-Y %d +X %d", &this->height, &this->width) != 2 || this->width <= 0 || this->height <= 0)
+	{
+		printf("Unsupported HDR file %s\n", fileName);
+		this->width = this->height = 0;
+		fclose(file);
+		return;
+	}
+
+	this->buffer = new vec4[this->width * this->height];
+	std::vector<unsigned char> scanline(this->width * 4);
+
+	for (int y = 0; y < this->height; y++)
+	{
+		if (!readScanline(file, this->width, &scanline[0]))
+		{
+			printf("Truncated HDR file %s\n", fileName);
+			std::fill(&this->buffer[y * this->width], &this->buffer[this->height * this->width], vec4(0));
+			break;
+		}
+
+		for (int x = 0; x < this->width; x++)
+		{
+			unsigned char* rgbe = &scanline[x * 4];
+			float scale = rgbe[3] ? ldexpf(1.0f, rgbe[3] - (128 + 8)) : 0;
+			this->buffer[y * this->width + x] = vec4(rgbe[0] * scale, rgbe[1] * scale, rgbe[2] * scale, 1.0f);
+		}
+	}
+
+	fclose(file);
+}
+
+#endif
@@ -0,0 +1,136 @@
+#include "precomp.h"
+
+Instance::Instance(BVH* bvh, mat4 transform, Material* material)
+{
+	this->bvh = bvh;
+	this->material = material;
+	this->boundingBox = new BoundingBox();
+
+	this->setTransform(transform);
+}
+
+Instance::~Instance()
+{
+	delete this->boundingBox;
+}
+
+void Instance::setTransform(mat4 transform)
+{
+	this->transform = transform;
+	this->inverseTransform = transform;
+	this->inverseTransform.invert();
+
+	mat4 identity = mat4::identity();
+	this->identity = memcmp(this->transform.cell, identity.cell, sizeof(identity.cell)) == 0;
+
+	this->calculateBounds();
+}
+
+void Instance::translate(vec3 vector)
+{
+	mat4 transform = this->transform;
+	transform[3] += vector.x;
+	transform[7] += vector.y;
+	transform[11] += vector.z;
+
+	this->setTransform(transform);
+}
+
+void Instance::calculateBounds()
+{
+	BVHNode* root = &this->bvh->nodes[0];
+	vec3 min = root->getMin(), max = root->getMax();
+
+	if (this->identity)
+	{
+		*this->boundingBox = BoundingBox(min, max);
+		return;
+	}
+
+	// bounds of the eight transformed corners of the root
+	vec3 worldMin = vec3(INFINITY), worldMax = vec3(-INFINITY);
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z);
+		vec4 point = vec4(corner, 1) * this->transform;
+
+		worldMin = vec3(MIN(worldMin.x, point.x), MIN(worldMin.y, point.y), MIN(worldMin.z, point.z));
+		worldMax = vec3(MAX(worldMax.x, point.x), MAX(worldMax.y, point.y), MAX(worldMax.z, point.z));
+	}
+
+	*this->boundingBox = BoundingBox(worldMin, worldMax);
+}
+
+void Instance::intersect(Ray* ray, std::vector<Primitive*>& primitives)
+{
+	Ray objectRay;
+	float scale = this->createObjectRay(ray, objectRay);
+	float t = objectRay.t;
+
+	for (int i = this->bvh->startIndex; i <= this->bvh->endIndex; i++)
+	{
+		if (this->bvh->mesh != NULL) this->bvh->mesh->intersect(i, &objectRay);
+		else primitives[i]->intersect(&objectRay);
+	}
+
+	// compared in object space, converting back can round a miss below the current distance
+	if (objectRay.t < t)
+	{
+		ray->t = objectRay.t / scale;
+		ray->intersectedObjectId = objectRay.intersectedObjectId;
+		ray->instanceId = this->id;
+	}
+}
+
+bool Instance::occludes(Ray* ray, std::vector<Primitive*>& primitives)
+{
+	Ray objectRay;
+	this->createObjectRay(ray, objectRay);
+
+	for (int i = this->bvh->startIndex; i <= this->bvh->endIndex; i++)
+	{
+		bool occludes = this->bvh->mesh != NULL ? this->bvh->mesh->occludes(i, &objectRay) : primitives[i]->occludes(&objectRay);
+		if (occludes)
+			return true;
+	}
+
+	return false;
+}
+
+vec3 Instance::toObjectPoint(vec3 point)
+{
+	vec4 objectPoint = vec4(point, 1) * this->inverseTransform;
+
+	return vec3(objectPoint.x, objectPoint.y, objectPoint.z);
+}
+
+vec3 Instance::toObjectDirection(vec3 direction, float& length)
+{
+	// the sphere, cylinder and torus tests need unit directions, scaled and sheared transforms change the length
+	vec4 objectDirection = vec4(direction, 0) * this->inverseTransform;
+	vec3 result = vec3(objectDirection.x, objectDirection.y, objectDirection.z);
+	length = result.length();
+
+	return result * (1 / length);
+}
+
+float Instance::createObjectRay(Ray* ray, Ray& objectRay)
+{
+	float scale;
+	objectRay.create(this->toObjectPoint(ray->origin), this->toObjectDirection(ray->direction, scale));
+	objectRay.t = ray->t * scale;
+
+	return scale;
+}
+
+vec3 Instance::toWorldNormal(vec3 normal)
+{
+	// normals are transformed with the transposed inverse
+	float* inverse = this->inverseTransform.cell;
+
+	return normalize(vec3(
+		inverse[0] * normal.x + inverse[4] * normal.y + inverse[8] * normal.z,
+		inverse[1] * normal.x + inverse[5] * normal.y + inverse[9] * normal.z,
+		inverse[2] * normal.x + inverse[6] * normal.y + inverse[10] * normal.z
+	));
+}
@@ -0,0 +1,33 @@
+#pragma once
+namespace Tmpl8
+{
+	// placement of a bottom level BVH in the scene, any number of instances can share one BVH and its primitives
+	class Instance
+	{
+	public:
+		Instance(BVH* bvh, mat4 transform, Material* material = NULL);
+		~Instance();
+
+		int id;
+		BVH* bvh;
+		Material* material; // overrides the materials of the primitives when set
+		mat4 transform, inverseTransform;
+		bool identity; // rays of identity instances are not transformed
+		BoundingBox* boundingBox; // world space bounds of the transformed BVH root
+
+		void setTransform(mat4 transform);
+		void translate(vec3 vector);
+		void calculateBounds();
+
+		// brute force intersection of all primitives of the BVH, for rendering without BVHs
+		void intersect(Ray* ray, std::vector<Primitive*>& primitives);
+		bool occludes(Ray* ray, std::vector<Primitive*>& primitives);
+
+		// object space rays have unit directions, so distances along them are scaled by the length of the transformed
+		// direction. createObjectRay converts t to object units and returns the object units per world unit.
+		vec3 toObjectPoint(vec3 point);
+		vec3 toObjectDirection(vec3 direction, float& length);
+		float createObjectRay(Ray* ray, Ray& objectRay);
+		vec3 toWorldNormal(vec3 normal);
+	};
+}
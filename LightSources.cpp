@@ -27,7 +27,7 @@ void DirectLight::intersect(Ray* ray)
 	}
 }
 
-vec3 DirectLight::getRandomPointOnLight(std::mt19937 randomNumbersGenerator)
+vec3 DirectLight::getPointOnLight(float u, float v)
 {
 	return this->position;
 }
@@ -71,16 +71,14 @@ void SphericalLight::intersect(Ray* ray)
 	}
 }
 
-vec3 SphericalLight::getRandomPointOnLight(std::mt19937 randomNumbersGenerator)
+vec3 SphericalLight::getPointOnLight(float u, float v)
 {
-	std::uniform_real_distribution<double> uniformGenerator01(0.0, 1.0);
+	float theta = 2 * PI * u;
+	float phi = acosf(1 - 2 * v);
 
-	double theta = 2 * M_PI * uniformGenerator01(randomNumbersGenerator);
-	double phi = acos(1 - 2 * uniformGenerator01(randomNumbersGenerator));
-
-	double x = sin(phi) * cos(theta);
-	double y = sin(phi) * sin(theta);
-	double z = cos(phi);
+	float x = sinf(phi) * cosf(theta);
+	float y = sinf(phi) * sinf(theta);
+	float z = cosf(phi);
 
 	return this->position + vec3(x, y, z);
 }
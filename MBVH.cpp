@@ -0,0 +1,173 @@
+#include "precomp.h"
+
+#define EMPTY_BOUNDS 1e30f
+
+WideRay::WideRay(Ray* ray)
+{
+	this->origin = ray->origin;
+	this->invertedDirection = ray->invertedDirection;
+
+	// for a negative direction the ray enters the slab through the max plane
+	for (int axis = 0; axis < 3; axis++)
+	{
+		this->nearPlane[axis] = this->invertedDirection[axis] >= 0 ? axis : axis + 3;
+		this->farPlane[axis] = this->invertedDirection[axis] >= 0 ? axis + 3 : axis;
+	}
+}
+
+int BVH4Node::intersect(const WideRay& ray, float rayT, float* entryDistances)
+{
+	const __m128 originX = _mm_set1_ps(ray.origin.x), originY = _mm_set1_ps(ray.origin.y), originZ = _mm_set1_ps(ray.origin.z);
+	const __m128 inverseX = _mm_set1_ps(ray.invertedDirection.x), inverseY = _mm_set1_ps(ray.invertedDirection.y), inverseZ = _mm_set1_ps(ray.invertedDirection.z);
+
+	__m128 tmin = _mm_mul_ps(_mm_sub_ps(this->bounds4[ray.nearPlane[0]], originX), inverseX);
+	tmin = _mm_max_ps(tmin, _mm_mul_ps(_mm_sub_ps(this->bounds4[ray.nearPlane[1]], originY), inverseY));
+	tmin = _mm_max_ps(tmin, _mm_mul_ps(_mm_sub_ps(this->bounds4[ray.nearPlane[2]], originZ), inverseZ));
+	tmin = _mm_max_ps(tmin, _mm_setzero_ps());
+
+	__m128 tmax = _mm_mul_ps(_mm_sub_ps(this->bounds4[ray.farPlane[0]], originX), inverseX);
+	tmax = _mm_min_ps(tmax, _mm_mul_ps(_mm_sub_ps(this->bounds4[ray.farPlane[1]], originY), inverseY));
+	tmax = _mm_min_ps(tmax, _mm_mul_ps(_mm_sub_ps(this->bounds4[ray.farPlane[2]], originZ), inverseZ));
+	tmax = _mm_min_ps(tmax, _mm_set1_ps(rayT));
+
+	_mm_storeu_ps(entryDistances, tmin);
+
+	return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+}
+
+int BVH8Node::intersect(const WideRay& ray, float rayT, float* entryDistances)
+{
+	const __m256 originX = _mm256_set1_ps(ray.origin.x), originY = _mm256_set1_ps(ray.origin.y), originZ = _mm256_set1_ps(ray.origin.z);
+	const __m256 inverseX = _mm256_set1_ps(ray.invertedDirection.x), inverseY = _mm256_set1_ps(ray.invertedDirection.y), inverseZ = _mm256_set1_ps(ray.invertedDirection.z);
+
+	__m256 tmin = _mm256_mul_ps(_mm256_sub_ps(this->bounds8[ray.nearPlane[0]], originX), inverseX);
+	tmin = _mm256_max_ps(tmin, _mm256_mul_ps(_mm256_sub_ps(this->bounds8[ray.nearPlane[1]], originY), inverseY));
+	tmin = _mm256_max_ps(tmin, _mm256_mul_ps(_mm256_sub_ps(this->bounds8[ray.nearPlane[2]], originZ), inverseZ));
+	tmin = _mm256_max_ps(tmin, _mm256_setzero_ps());
+
+	__m256 tmax = _mm256_mul_ps(_mm256_sub_ps(this->bounds8[ray.farPlane[0]], originX), inverseX);
+	tmax = _mm256_min_ps(tmax, _mm256_mul_ps(_mm256_sub_ps(this->bounds8[ray.farPlane[1]], originY), inverseY));
+	tmax = _mm256_min_ps(tmax, _mm256_mul_ps(_mm256_sub_ps(this->bounds8[ray.farPlane[2]], originZ), inverseZ));
+	tmax = _mm256_min_ps(tmax, _mm256_set1_ps(rayT));
+
+	_mm256_storeu_ps(entryDistances, tmin);
+
+	return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+}
+
+template <class WideNode>
+MBVH<WideNode>::MBVH(BVH* bvh)
+{
+	// every wide node replaces at least one interior binary node, the root is needed even if it is a leaf
+	this->nodesAllocated = MAX(bvh->nodesUsed, 1);
+	this->nodes = (WideNode*)MALLOC64(this->nodesAllocated * sizeof(WideNode));
+	this->nodesUsed = 0;
+
+	this->collapse(bvh, &bvh->nodes[0]);
+}
+
+template <class WideNode>
+MBVH<WideNode>::MBVH(int nodesCount)
+{
+	this->nodesAllocated = MAX(nodesCount, 1);
+	this->nodes = (WideNode*)MALLOC64(this->nodesAllocated * sizeof(WideNode));
+	this->nodesUsed = nodesCount;
+}
+
+template <class WideNode>
+MBVH<WideNode>::~MBVH()
+{
+	FREE64(this->nodes);
+}
+
+template <class WideNode>
+int MBVH<WideNode>::collapse(BVH* bvh, BVHNode* node)
+{
+	int index = this->nodesUsed++;
+
+	// open the interior child with the largest surface area until all slots are used
+	BVHNode* children[WideNode::WIDTH];
+	int childrenCount = 1;
+	children[0] = node;
+
+	while (childrenCount < WideNode::WIDTH)
+	{
+		int largest = -1;
+		float largestSurfaceArea = -1;
+		for (int i = 0; i < childrenCount; i++)
+		{
+			if (children[i]->isLeaf()) continue;
+
+			float surfaceArea = children[i]->calculateSurfaceArea();
+			if (surfaceArea > largestSurfaceArea)
+			{
+				largest = i;
+				largestSurfaceArea = surfaceArea;
+			}
+		}
+		if (largest == -1) break;
+
+		BVHNode* opened = children[largest];
+		children[largest] = opened + 1;
+		children[childrenCount++] = &bvh->nodes[opened->leftFirst];
+	}
+
+	for (int i = 0; i < WideNode::WIDTH; i++)
+	{
+		if (i >= childrenCount)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				this->nodes[index].bounds[axis][i] = EMPTY_BOUNDS;
+				this->nodes[index].bounds[axis + 3][i] = -EMPTY_BOUNDS;
+			}
+			this->nodes[index].child[i] = 0;
+			this->nodes[index].count[i] = -1;
+
+			continue;
+		}
+
+		BVHNode* child = children[i];
+		vec3 min = child->getMin(), max = child->getMax();
+		for (int axis = 0; axis < 3; axis++)
+		{
+			this->nodes[index].bounds[axis][i] = min[axis];
+			this->nodes[index].bounds[axis + 3][i] = max[axis];
+		}
+
+		if (child->isLeaf())
+		{
+			this->nodes[index].child[i] = child->leftFirst;
+			this->nodes[index].count[i] = child->count;
+		}
+		else
+		{
+			int childIndex = this->collapse(bvh, child);
+			this->nodes[index].child[i] = childIndex;
+			this->nodes[index].count[i] = 0;
+		}
+	}
+
+	return index;
+}
+
+template <class WideNode>
+void MBVH<WideNode>::translate(vec3 vector)
+{
+	for (int i = 0; i < this->nodesUsed; i++)
+	{
+		for (int j = 0; j < WideNode::WIDTH; j++)
+		{
+			if (this->nodes[i].count[j] == -1) continue;
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				this->nodes[i].bounds[axis][j] += vector[axis];
+				this->nodes[i].bounds[axis + 3][j] += vector[axis];
+			}
+		}
+	}
+}
+
+template class MBVH<BVH4Node>;
+template class MBVH<BVH8Node>;
@@ -0,0 +1,65 @@
+#pragma once
+namespace Tmpl8
+{
+	class BVH;
+
+	// ray data shared by the SIMD slab tests of all nodes visited by one traversal
+	class WideRay
+	{
+	public:
+		WideRay(Ray* ray);
+
+		vec3 origin, invertedDirection;
+		int nearPlane[3], farPlane[3]; // bounds index of the entry and exit plane per axis
+	};
+
+	// 4-wide node with the bounds of all children in SoA form, tested with a single SSE slab test.
+	// Per child slot: count > 0 marks a leaf (child is the first object index), 0 an interior node (child is a node index)
+	// and -1 an empty slot, which has inverted bounds so it never intersects.
+	class alignas(64) BVH4Node
+	{
+	public:
+		static const int WIDTH = 4;
+
+		union { __m128 bounds4[6]; float bounds[6][4]; }; // minX, minY, minZ, maxX, maxY, maxZ
+		int child[4];
+		int count[4];
+
+		int intersect(const WideRay& ray, float rayT, float* entryDistances);
+	};
+
+	// 8-wide node, same layout as BVH4Node with AVX registers
+	class alignas(64) BVH8Node
+	{
+	public:
+		static const int WIDTH = 8;
+
+		union { __m256 bounds8[6]; float bounds[6][8]; };
+		int child[8];
+		int count[8];
+
+		int intersect(const WideRay& ray, float rayT, float* entryDistances);
+	};
+
+	// wide BVH collapsed from the binary SAH tree of a BVH, leaves keep referencing its objectIndices
+	template <class WideNode>
+	class MBVH
+	{
+	public:
+		MBVH(BVH* bvh);
+		MBVH(int nodesCount); // leaves the nodes to be filled, as by the mesh cache
+		~MBVH();
+
+		WideNode* nodes; // root at index 0
+		int nodesUsed;
+		int nodesAllocated; // up to one wide node per binary node
+
+		void translate(vec3 vector);
+
+	private:
+		int collapse(BVH* bvh, BVHNode* node);
+	};
+
+	typedef MBVH<BVH4Node> BVH4;
+	typedef MBVH<BVH8Node> BVH8;
+}
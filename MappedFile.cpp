@@ -0,0 +1,70 @@
+#include "precomp.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const char* fileName)
+{
+	this->data = NULL;
+	this->size = 0;
+	this->mapping = NULL;
+
+	this->file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (this->file == INVALID_HANDLE_VALUE) return;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(this->file, &fileSize) || fileSize.QuadPart == 0) return;
+
+	this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!this->mapping) return;
+
+	this->data = (const char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (this->data) this->size = (size_t)fileSize.QuadPart;
+}
+
+MappedFile::~MappedFile()
+{
+	if (this->data) UnmapViewOfFile(this->data);
+	if (this->mapping) CloseHandle(this->mapping);
+	if (this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+}
+
+#else
+
+MappedFile::MappedFile(const char* fileName)
+{
+	this->data = NULL;
+	this->size = 0;
+
+	int file = open(fileName, O_RDONLY);
+	if (file < 0) return;
+
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0)
+	{
+		void* view = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (view != MAP_FAILED)
+		{
+			madvise(view, status.st_size, MADV_SEQUENTIAL);
+			this->data = (const char*)view;
+			this->size = status.st_size;
+		}
+	}
+
+	// the mapping keeps its own reference to the file
+	close(file);
+}
+
+MappedFile::~MappedFile()
+{
+	if (this->data) munmap((void*)this->data, this->size);
+}
+
+#endif
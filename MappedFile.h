@@ -0,0 +1,21 @@
+#pragma once
+namespace Tmpl8
+{
+	// read only view of a whole file in memory, pages are loaded by the OS as they are touched
+	class MappedFile
+	{
+	public:
+		MappedFile(const char* fileName);
+		~MappedFile();
+
+		const char* data; // NULL when the file could not be opened or is empty
+		size_t size;
+
+		bool isOpen() { return this->data != NULL; }
+
+	private:
+#ifdef _WIN32
+		void *file, *mapping;
+#endif
+	};
+}
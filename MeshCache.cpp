@@ -0,0 +1,266 @@
+#include "precomp.h"
+
+#define MESH_CACHE_VERSION 3
+#define MESH_CACHE_ALIGNMENT 64 // sections start at multiples of this, the SIMD nodes and packets stay aligned in the mapping
+#define MESH_CACHE_SECTIONS 8
+
+bool MeshCache::enabled = MESH_CACHE_ENABLED;
+
+// everything that changes the layout or the content of the cached arrays
+struct MeshCacheHeader
+{
+	char magic[8];
+	int version;
+	int buildMode, bvhWidth, packetWidth;
+	int nodeSize, wideNodeSize, packetSize;
+	unsigned long long sourceSize, sourceHash;
+
+	int trianglesCount, verticesCount, stride;
+	int nodesCount, referencesCount, wideNodesCount, packetsCount;
+	int spatialSplitsCount;
+	float SAHCost;
+};
+
+static size_t align(size_t size)
+{
+	return (size + MESH_CACHE_ALIGNMENT - 1) & ~(size_t)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static std::string getCacheName(const char* fileName)
+{
+	return std::string(fileName) + ".cache";
+}
+
+static MeshCacheHeader createHeader(BVHBuildMode buildMode)
+{
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "MESHBVH", 8);
+	header.version = MESH_CACHE_VERSION;
+	header.buildMode = buildMode;
+	header.bvhWidth = BVH_WIDTH;
+	header.packetWidth = TRIANGLE_PACKET_WIDTH;
+	header.nodeSize = sizeof(BVHNode);
+	header.wideNodeSize = BVH_WIDTH == 8 ? sizeof(BVH8Node) : BVH_WIDTH == 4 ? sizeof(BVH4Node) : 0;
+	header.packetSize = TRIANGLE_PACKET_WIDTH == 8 ? sizeof(TrianglePacket8) : TRIANGLE_PACKET_WIDTH == 4 ? sizeof(TrianglePacket4) : 0;
+	return header;
+}
+
+// vertices, indices, triangle arrays, nodes, object indices, wide nodes, packets and packet indices
+static void getSectionSizes(const MeshCacheHeader& header, size_t* sizes)
+{
+	sizes[0] = (size_t)header.verticesCount * 3 * sizeof(float);
+	sizes[1] = (size_t)header.trianglesCount * 3 * sizeof(int);
+	sizes[2] = (size_t)header.stride * (header.packetWidth > 1 ? 3 : 12) * sizeof(float); // see TriangleMesh::getArraysCount
+	sizes[3] = (size_t)header.nodesCount * header.nodeSize;
+	sizes[4] = (size_t)header.referencesCount * sizeof(int);
+	sizes[5] = (size_t)header.wideNodesCount * header.wideNodeSize;
+	sizes[6] = (size_t)header.packetsCount * header.packetSize;
+	sizes[7] = header.packetsCount > 0 ? (size_t)header.referencesCount * sizeof(int) : 0;
+}
+
+static bool hashSource(const char* fileName, unsigned long long& size, unsigned long long& hash)
+{
+	MappedFile source(fileName);
+	if (!source.isOpen()) return false;
+
+	size = source.size;
+	hash = MeshCache::hash(source.data, source.size);
+	return true;
+}
+
+static void writeSection(FILE* file, const void* data, size_t size)
+{
+	static const char padding[MESH_CACHE_ALIGNMENT] = {};
+
+	if (size > 0) fwrite(data, 1, size, file);
+	fwrite(padding, 1, align(size) - size, file);
+}
+
+// multiply and rotate over 8 byte words, fast enough to check large sources on every load
+unsigned long long MeshCache::hash(const char* data, size_t size)
+{
+	unsigned long long hash = size * 0x9e3779b97f4a7c15ULL;
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 32;
+	}
+
+	unsigned long long tail = 0;
+	memcpy(&tail, data + i, size - i);
+	hash = (hash ^ tail) * 0xff51afd7ed558ccdULL;
+
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+BVH* MeshCache::load(const char* fileName, Material* material, BVHBuildMode buildMode)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::string cacheName = getCacheName(fileName);
+	MappedFile cache(cacheName.c_str());
+	if (!cache.isOpen() || cache.size < sizeof(MeshCacheHeader))
+	{
+		return NULL;
+	}
+
+	MeshCacheHeader header, expected = createHeader(buildMode);
+	memcpy(&header, cache.data, sizeof(header));
+	if (memcmp(header.magic, expected.magic, sizeof(header.magic)) || header.version != expected.version ||
+		header.buildMode != expected.buildMode || header.bvhWidth != expected.bvhWidth || header.packetWidth != expected.packetWidth ||
+		header.nodeSize != expected.nodeSize || header.wideNodeSize != expected.wideNodeSize || header.packetSize != expected.packetSize)
+	{
+		printf("%s: written by other build settings, rebuilding\n", cacheName.c_str());
+		return NULL;
+	}
+
+	unsigned long long sourceSize, sourceHash;
+	if (!hashSource(fileName, sourceSize, sourceHash) || sourceSize != header.sourceSize || sourceHash != header.sourceHash)
+	{
+		printf("%s: %s changed, rebuilding\n", cacheName.c_str(), fileName);
+		return NULL;
+	}
+
+	size_t sizes[MESH_CACHE_SECTIONS];
+	const char* sections[MESH_CACHE_SECTIONS];
+	getSectionSizes(header, sizes);
+	size_t offset = align(sizeof(header));
+	for (int i = 0; i < MESH_CACHE_SECTIONS; i++)
+	{
+		sections[i] = cache.data + offset;
+		offset += align(sizes[i]);
+	}
+	if (offset > cache.size)
+	{
+		printf("%s: truncated, rebuilding\n", cacheName.c_str());
+		return NULL;
+	}
+
+	TriangleMesh* mesh = new TriangleMesh(material, header.trianglesCount);
+
+	mesh->vertices.assign((const float*)sections[0], (const float*)sections[0] + header.verticesCount * 3);
+	mesh->indices.assign((const int*)sections[1], (const int*)sections[1] + header.trianglesCount * 3);
+	memcpy(mesh->normalX, sections[2], sizes[2]);
+
+	BVH* bvh = new BVH(std::vector<Primitive*>(), mesh);
+	bvh->buildMode = buildMode;
+	bvh->startIndex = 0;
+	bvh->endIndex = header.trianglesCount - 1;
+	bvh->objectsCount = header.trianglesCount;
+	bvh->referencesCount = header.referencesCount;
+	bvh->spatialSplitsCount = header.spatialSplitsCount;
+	bvh->SAHCost = header.SAHCost;
+
+	bvh->nodesAllocated = MAX(header.nodesCount, 1);
+	bvh->nodes = (BVHNode*)MALLOC64(bvh->nodesAllocated * sizeof(BVHNode));
+	bvh->nodesUsed = header.nodesCount;
+	memcpy(bvh->nodes, sections[3], sizes[3]);
+
+	bvh->objectIndicesCount = header.referencesCount;
+	bvh->objectIndices = new int[MAX(header.referencesCount, 1)];
+	memcpy(bvh->objectIndices, sections[4], sizes[4]);
+
+	if (BVH_WIDTH == 4)
+	{
+		bvh->bvh4 = new BVH4(header.wideNodesCount);
+		memcpy(bvh->bvh4->nodes, sections[5], sizes[5]);
+	}
+	if (BVH_WIDTH == 8)
+	{
+		bvh->bvh8 = new BVH8(header.wideNodesCount);
+		memcpy(bvh->bvh8->nodes, sections[5], sizes[5]);
+	}
+
+	if (header.packetsCount > 0)
+	{
+		bvh->packetsCount = header.packetsCount;
+		void* packets = MALLOC64(sizes[6]);
+		memcpy(packets, sections[6], sizes[6]);
+		if (TRIANGLE_PACKET_WIDTH == 4) bvh->packets4 = (TrianglePacket4*)packets;
+		if (TRIANGLE_PACKET_WIDTH == 8) bvh->packets8 = (TrianglePacket8*)packets;
+
+		bvh->packetIndices = new int[MAX(header.referencesCount, 1)];
+		memcpy(bvh->packetIndices, sections[7], sizes[7]);
+	}
+
+	printf("%s: loaded %i triangles and %i nodes from %s, %.2f ms\n", fileName, header.trianglesCount, header.nodesCount, cacheName.c_str(),
+		std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+	return bvh;
+}
+
+bool MeshCache::save(const char* fileName, BVH* bvh)
+{
+	TriangleMesh* mesh = bvh->mesh;
+
+	MeshCacheHeader header = createHeader(bvh->buildMode);
+	if (!hashSource(fileName, header.sourceSize, header.sourceHash))
+	{
+		return false;
+	}
+
+	header.trianglesCount = mesh->count;
+	header.verticesCount = mesh->vertices.size() / 3;
+	header.stride = mesh->stride;
+	header.nodesCount = bvh->nodesUsed;
+	header.referencesCount = bvh->referencesCount;
+	header.wideNodesCount = bvh->bvh4 ? bvh->bvh4->nodesUsed : bvh->bvh8 ? bvh->bvh8->nodesUsed : 0;
+	header.spatialSplitsCount = bvh->spatialSplitsCount;
+	header.SAHCost = bvh->SAHCost;
+
+	header.packetsCount = bvh->packetsCount;
+
+	const void* data[MESH_CACHE_SECTIONS] = {
+		mesh->vertices.empty() ? NULL : &mesh->vertices[0],
+		mesh->indices.empty() ? NULL : &mesh->indices[0],
+		mesh->normalX,
+		bvh->nodes,
+		bvh->objectIndices,
+		bvh->bvh4 ? (void*)bvh->bvh4->nodes : bvh->bvh8 ? (void*)bvh->bvh8->nodes : NULL,
+		bvh->packets4 ? (void*)bvh->packets4 : (void*)bvh->packets8,
+		bvh->packetIndices
+	};
+	size_t sizes[MESH_CACHE_SECTIONS];
+	getSectionSizes(header, sizes);
+
+	// written under another name first, so an interrupted write never leaves a cache that looks valid
+	std::string cacheName = getCacheName(fileName);
+	std::string temporaryName = cacheName + ".tmp";
+	FILE* file = fopen(temporaryName.c_str(), "wb");
+	if (!file)
+	{
+		printf("Cannot write %s\n", cacheName.c_str());
+		return false;
+	}
+
+	writeSection(file, &header, sizeof(header));
+	for (int i = 0; i < MESH_CACHE_SECTIONS; i++)
+	{
+		writeSection(file, data[i], sizes[i]);
+	}
+
+	bool written = !ferror(file);
+	written = fclose(file) == 0 && written;
+
+	if (written)
+	{
+		remove(cacheName.c_str());
+		written = rename(temporaryName.c_str(), cacheName.c_str()) == 0;
+	}
+	if (!written)
+	{
+		printf("Cannot write %s\n", cacheName.c_str());
+		remove(temporaryName.c_str());
+		return false;
+	}
+
+	return true;
+}
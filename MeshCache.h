@@ -0,0 +1,17 @@
+#pragma once
+namespace Tmpl8
+{
+	// binary snapshot of a loaded model next to its file: the vertex and index buffers, the triangle arrays and the
+	// finished BVH with its wide nodes and packets. It is valid while the size and hash of the source and the build
+	// settings match, loading maps the file and copies the arrays without parsing or building anything.
+	class MeshCache
+	{
+	public:
+		static bool enabled; // MESH_CACHE_ENABLED unless changed at runtime
+
+		static BVH* load(const char* fileName, Material* material, BVHBuildMode buildMode); // NULL when missing or stale
+		static bool save(const char* fileName, BVH* bvh);
+
+		static unsigned long long hash(const char* data, size_t size);
+	};
+}
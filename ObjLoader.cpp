@@ -0,0 +1,209 @@
+#include "precomp.h"
+
+#define MAX_FAST_DIGITS 15 // decimal digits that always fit the 53 bit mantissa of a double
+#define MAX_FAST_EXPONENT 22 // largest power of ten that is exact in a double
+
+static const double powersOfTen[MAX_FAST_EXPONENT + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static const char* skipSpaces(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t')) p++;
+	return p;
+}
+
+static const char* skipLine(const char* p, const char* end)
+{
+	while (p < end && *p != '\n') p++;
+	return p < end ? p + 1 : p;
+}
+
+// parses a decimal number without copying or locale lookups. A mantissa and exponent that are both exact in a double
+// give the correctly rounded result with one multiplication or division, anything longer or larger goes to strtof.
+static const char* parseFloat(const char* p, const char* end, float& value)
+{
+	const char* start = p;
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) p++;
+
+	unsigned long long mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool hasDigits = false;
+
+	for (; p < end && isDigit(*p); p++)
+	{
+		hasDigits = true;
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa) digits++;
+		}
+		else exponent++;
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && isDigit(*p); p++)
+		{
+			hasDigits = true;
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa) digits++;
+				exponent--;
+			}
+		}
+	}
+	if (hasDigits && p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool negativeExponent = q < end && *q == '-';
+		if (q < end && (*q == '-' || *q == '+')) q++;
+		if (q < end && isDigit(*q))
+		{
+			int value = 0;
+			for (; q < end && isDigit(*q); q++)
+			{
+				if (value < 10000) value = value * 10 + (*q - '0');
+			}
+			exponent += negativeExponent ? -value : value;
+			p = q;
+		}
+	}
+
+	if (hasDigits && digits <= MAX_FAST_DIGITS && exponent >= -MAX_FAST_EXPONENT && exponent <= MAX_FAST_EXPONENT)
+	{
+		double result = (double)mantissa;
+		result = exponent < 0 ? result / powersOfTen[-exponent] : result * powersOfTen[exponent];
+		value = (float)(negative ? -result : result);
+		return p;
+	}
+
+	// long numbers, huge exponents, inf and nan, the mapped file is not null terminated so the token is copied
+	char token[64];
+	int length = 0;
+	for (p = start; p < end && length < 63 && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'; p++)
+	{
+		token[length++] = *p;
+	}
+	token[length] = 0;
+
+	char* tokenEnd;
+	value = strtof(token, &tokenEnd);
+	return tokenEnd == token ? NULL : start + (tokenEnd - token);
+}
+
+static const char* parseInteger(const char* p, const char* end, int& value)
+{
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) p++;
+	if (p >= end || !isDigit(*p)) return NULL;
+
+	value = 0;
+	for (; p < end && isDigit(*p); p++)
+	{
+		value = value * 10 + (*p - '0');
+	}
+	if (negative) value = -value;
+
+	return p;
+}
+
+bool ObjLoader::load(const char* fileName, std::vector<float>& vertices, std::vector<int>& indices)
+{
+	MappedFile file(fileName);
+	if (!file.isOpen())
+	{
+		printf("Cannot load %s file!\n", fileName);
+		return false;
+	}
+
+	const char* p = file.data;
+	const char* end = file.data + file.size;
+
+	// face lines are usually a little longer than vertex lines, this reserves a bit more than needed for a triangle mesh
+	vertices.reserve(file.size / 64 * 3);
+	indices.reserve(file.size / 16);
+
+	std::vector<int> polygon;
+	int invalidFaces = 0;
+
+	while (p < end)
+	{
+		p = skipSpaces(p, end);
+		if (p + 1 >= end)
+		{
+			break;
+		}
+
+		if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			float coordinates[3];
+			p += 2;
+			for (int i = 0; i < 3 && p; i++)
+			{
+				p = parseFloat(skipSpaces(p, end), end, coordinates[i]);
+			}
+			if (!p)
+			{
+				printf("Invalid vertex in %s\n", fileName);
+				return false;
+			}
+			vertices.insert(vertices.end(), coordinates, coordinates + 3);
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			// every corner is v, v/vt, v//vn or v/vt/vn, only the position index is used
+			polygon.clear();
+			p = skipSpaces(p + 2, end);
+			bool valid = true;
+			while (p < end && *p != '\n' && *p != '\r')
+			{
+				int index;
+				const char* next = parseInteger(p, end, index);
+				if (!next)
+				{
+					valid = false;
+					break;
+				}
+				p = next;
+
+				// indices start at one, negative ones count back from the last vertex read
+				int verticesCount = vertices.size() / 3;
+				index = index < 0 ? verticesCount + index : index - 1;
+				if (index < 0 || index >= verticesCount) valid = false;
+				polygon.push_back(index);
+
+				while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+				p = skipSpaces(p, end);
+			}
+
+			if (valid && polygon.size() >= 3)
+			{
+				for (int i = 1; i + 1 < polygon.size(); i++)
+				{
+					indices.push_back(polygon[0]);
+					indices.push_back(polygon[i]);
+					indices.push_back(polygon[i + 1]);
+				}
+			}
+			else invalidFaces++;
+		}
+
+		// comments, texture coordinates, normals, groups, materials and anything unknown
+		p = skipLine(p, end);
+	}
+
+	if (invalidFaces > 0)
+	{
+		printf("Skipped %d invalid faces in %s\n", invalidFaces, fileName);
+	}
+
+	return true;
+}
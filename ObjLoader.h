@@ -0,0 +1,11 @@
+#pragma once
+namespace Tmpl8
+{
+	// Wavefront OBJ reader for the geometry of a model. Faces of any size are fan triangulated into an index
+	// buffer over one shared vertex buffer of packed x, y, z floats. Texture coordinates, normals and everything else are skipped.
+	class ObjLoader
+	{
+	public:
+		static bool load(const char* fileName, std::vector<float>& vertices, std::vector<int>& indices);
+	};
+}
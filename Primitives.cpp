@@ -6,14 +6,42 @@ Material::Material(vec4 color, MaterialType type)
 	this->type = type;
 }
 
-Primitive::Primitive(Material* material)
+Primitive::Primitive(Material* material, PrimitiveType type)
 {
 	this->material = material;
+	this->type = type;
+}
+
+bool Primitive::occludes(Ray* ray)
+{
+	// generic fallback through the closest hit kernel, ray is left untouched
+	float t = ray->t;
+	int intersectedObjectId = ray->intersectedObjectId;
+
+	this->intersect(ray);
+	bool occludes = ray->t < t;
+
+	ray->t = t;
+	ray->intersectedObjectId = intersectedObjectId;
+
+	return occludes;
+}
+
+void Primitive::clip(const BoundingBox& bounds, int axis, float position, BoundingBox& left, BoundingBox& right)
+{
+	// generic fallback, splits the bounds themselves
+	left = bounds;
+	left.max[axis] = MIN(left.max[axis], position);
+	left.calculateCenter();
+
+	right = bounds;
+	right.min[axis] = MAX(right.min[axis], position);
+	right.calculateCenter();
 }
 
 // -------------------- SPHERE ------------------------------------
 
-Sphere::Sphere(Material* material, vec3 position, float radius) : Primitive(material)
+Sphere::Sphere(Material* material, vec3 position, float radius) : Primitive(material, spherePrimitive)
 {
 	this->position = position;
 	this->radius = radius;
@@ -40,6 +68,21 @@ void Sphere::intersect(Ray* ray)
 	}
 }
 
+bool Sphere::occludes(Ray* ray)
+{
+	vec3 c = this->position - ray->origin;
+	float t = dot(c, ray->direction);
+	if (t < 0) return false;
+	vec3 q = c - t * ray->direction;
+	float p2 = dot(q, q);
+
+	if (p2 > this->radius2) return false;
+
+	t -= sqrt(this->radius2 - p2);
+
+	return t < ray->t && t >= EPSILON;
+}
+
 vec3 Sphere::getNormal(vec3 point)
 {
 	return normalize(point - this->position);
@@ -53,7 +96,7 @@ void Sphere::translate(vec3 vector)
 
 // -------------------- TRIANGLE ------------------------------------
 
-Triangle::Triangle(Material* material, vec3 a, vec3 b, vec3 c) : Primitive(material)
+Triangle::Triangle(Material* material, vec3 a, vec3 b, vec3 c) : Primitive(material, trianglePrimitive)
 {
 	this->a = a;
 	this->b = b;
@@ -102,6 +145,26 @@ void Triangle::intersect(Ray* ray)
 	}
 }
 
+bool Triangle::occludes(Ray* ray)
+{
+	vec3 ab = this->b - this->a;
+	vec3 ac = this->c - this->a;
+	vec3 pvec = ray->direction.cross(ac);
+	float invDet = 1 / ab.dot(pvec);
+
+	vec3 tvec = ray->origin - a;
+	float u = tvec.dot(pvec) * invDet;
+	if (u < 0 || u > 1) return false;
+
+	vec3 qvec = tvec.cross(ab);
+	float v = ray->direction.dot(qvec) * invDet;
+	if (v < 0 || u + v > 1) return false;
+
+	float t = ac.dot(qvec) * invDet;
+
+	return t < ray->t && t >= EPSILON;
+}
+
 vec3 Triangle::getNormal(vec3 point)
 {
 	return this->normal;
@@ -116,9 +179,60 @@ void Triangle::translate(vec3 vector)
 	this->boundingBox->translate(vector);
 }
 
+void Triangle::clip(const BoundingBox& bounds, int axis, float position, BoundingBox& left, BoundingBox& right)
+{
+	Triangle::clip(this->a, this->b, this->c, bounds, axis, position, left, right);
+}
+
+void Triangle::clip(vec3 a, vec3 b, vec3 c, const BoundingBox& bounds, int axis, float position, BoundingBox& left, BoundingBox& right)
+{
+	// bounds of both parts of the triangle from its vertices and the points where its edges cross the plane
+	vec3 leftMin = vec3(INFINITY), leftMax = vec3(-INFINITY);
+	vec3 rightMin = vec3(INFINITY), rightMax = vec3(-INFINITY);
+
+	vec3 vertices[3] = { a, b, c };
+	for (int i = 0; i < 3; i++)
+	{
+		vec3 v0 = vertices[i], v1 = vertices[(i + 1) % 3];
+		float p0 = v0[axis], p1 = v1[axis];
+
+		if (p0 <= position)
+		{
+			leftMin = vec3(MIN(leftMin.x, v0.x), MIN(leftMin.y, v0.y), MIN(leftMin.z, v0.z));
+			leftMax = vec3(MAX(leftMax.x, v0.x), MAX(leftMax.y, v0.y), MAX(leftMax.z, v0.z));
+		}
+		if (p0 >= position)
+		{
+			rightMin = vec3(MIN(rightMin.x, v0.x), MIN(rightMin.y, v0.y), MIN(rightMin.z, v0.z));
+			rightMax = vec3(MAX(rightMax.x, v0.x), MAX(rightMax.y, v0.y), MAX(rightMax.z, v0.z));
+		}
+
+		if ((p0 < position && p1 > position) || (p0 > position && p1 < position))
+		{
+			vec3 crossing = v0 + (v1 - v0) * ((position - p0) / (p1 - p0));
+			crossing[axis] = position;
+
+			leftMin = vec3(MIN(leftMin.x, crossing.x), MIN(leftMin.y, crossing.y), MIN(leftMin.z, crossing.z));
+			leftMax = vec3(MAX(leftMax.x, crossing.x), MAX(leftMax.y, crossing.y), MAX(leftMax.z, crossing.z));
+			rightMin = vec3(MIN(rightMin.x, crossing.x), MIN(rightMin.y, crossing.y), MIN(rightMin.z, crossing.z));
+			rightMax = vec3(MAX(rightMax.x, crossing.x), MAX(rightMax.y, crossing.y), MAX(rightMax.z, crossing.z));
+		}
+	}
+
+	// the part being split may already be clipped by earlier splits
+	left = BoundingBox(
+		vec3(MAX(leftMin.x, bounds.min.x), MAX(leftMin.y, bounds.min.y), MAX(leftMin.z, bounds.min.z)),
+		vec3(MIN(leftMax.x, bounds.max.x), MIN(leftMax.y, bounds.max.y), MIN(leftMax.z, bounds.max.z))
+	);
+	right = BoundingBox(
+		vec3(MAX(rightMin.x, bounds.min.x), MAX(rightMin.y, bounds.min.y), MAX(rightMin.z, bounds.min.z)),
+		vec3(MIN(rightMax.x, bounds.max.x), MIN(rightMax.y, bounds.max.y), MIN(rightMax.z, bounds.max.z))
+	);
+}
+
 // -------------------- PLANE ------------------------------------
 
-Plane::Plane(Material* material, vec3 position, vec3 direction, float size) : Primitive(material)
+Plane::Plane(Material* material, vec3 position, vec3 direction, float size) : Primitive(material, planePrimitive)
 {
 	this->position = position;
 	this->direction = direction;
@@ -139,6 +253,16 @@ void Plane::intersect(Ray* ray)
 	}
 }
 
+bool Plane::occludes(Ray* ray)
+{
+	float denominator = dot(this->direction, ray->direction);
+	if (abs(denominator) <= EPSILON) return false;
+
+	float t = dot(this->position - ray->origin, this->direction) / denominator;
+
+	return t < ray->t && t >= EPSILON;
+}
+
 vec3 Plane::getNormal(vec3 point)
 {
 	return normalize(this->direction);
@@ -152,7 +276,7 @@ void Plane::translate(vec3 vector)
 
 // -------------------- CYLINDER ------------------------------------
 
-Cylinder::Cylinder(Material* material, vec3 position, vec3 upVector, float radius, float height) : Primitive(material)
+Cylinder::Cylinder(Material* material, vec3 position, vec3 upVector, float radius, float height) : Primitive(material, cylinderPrimitive)
 {
 	this->position = position;
 	this->upVector = upVector;
@@ -171,7 +295,23 @@ Cylinder::Cylinder(Material* material, vec3 position, vec3 upVector, float radiu
 
 void Cylinder::intersect(Ray* ray)
 {
-	vector<float> points;
+	float t = this->calculateDistance(ray);
+	if (t < ray->t)
+	{
+		ray->t = t / ray->direction.length();
+		ray->intersectedObjectId = this->id;
+	}
+}
+
+bool Cylinder::occludes(Ray* ray)
+{
+	return this->calculateDistance(ray) < ray->t;
+}
+
+float Cylinder::calculateDistance(Ray* ray)
+{
+	// nearest of the hits with the side and the caps, INFINITY if there is none
+	float nearest = INFINITY;
 	vec3 alpha = upVector * ray->direction.dot(upVector);
 	vec3 deltaPosition = (ray->origin - this->position);
 	vec3 beta = upVector * deltaPosition.dot(upVector);
@@ -182,25 +322,24 @@ void Cylinder::intersect(Ray* ray)
 	float c = (deltaPosition - beta).sqrLentgh() - radius*radius;
 
 	float discriminant = b * b - 4 * a * c;
-	if (discriminant < 0) { return; }
-	else
+	if (discriminant < 0) { return INFINITY; }
+
+	// the side only counts between the two caps
+	discriminant = sqrt(discriminant);
+	float t1 = ((-1 * b) + discriminant) / (2 * a);
+	float t2 = ((-1 * b) - discriminant) / (2 * a);
+	if (t1 >= EPSILON && t1 < nearest)
 	{
-		discriminant = sqrt(discriminant);
-		float t1 = ((-1 * b) + discriminant) / (2 * a);
-		float t2 = ((-1 * b) - discriminant) / (2 * a);
-		if (t1 >= 0)
+		if (upVector.dot((ray->origin - this->position) + ray->direction * t1) > 0 && upVector.dot((ray->origin - center2) + ray->direction * t1) < 0)
 		{
-			if (upVector.dot((ray->origin - this->position) + ray->direction * t1) > 0 && upVector.dot((ray->origin - center2) + ray->direction * t1) < 0)
-			{
-				points.push_back(t1);
-			}
+			nearest = t1;
 		}
-		if (t2 >= 0)
+	}
+	if (t2 >= EPSILON && t2 < nearest)
+	{
+		if (upVector.dot((ray->origin - this->position) + ray->direction * t2) > 0 && upVector.dot((ray->origin - center2) + ray->direction * t2) < 0)
 		{
-			if (upVector.dot((ray->origin - this->position) + ray->direction * t2) > 0 && upVector.dot((ray->origin - center2) + ray->direction * t2) < 0)
-			{
-				points.push_back(t2);
-			}
+			nearest = t2;
 		}
 	}
 
@@ -209,37 +348,22 @@ void Cylinder::intersect(Ray* ray)
 	{
 		vec3 co = this->position - ray->origin;
 		float t3 = co.dot(upVector) / denominator;
-		if (t3 > 0 && (ray->direction * t3 - co).sqrLentgh() <= radius*radius)
+		if (t3 >= EPSILON && t3 < nearest && (ray->direction * t3 - co).sqrLentgh() <= radius*radius)
 		{
-			points.push_back(t3);
+			nearest = t3;
 		}
 	}
 	else if (denominator < EPSILON)
 	{
 		vec3 co2 = center2 - ray->origin;
 		float t4 = co2.dot(upVector) / denominator;
-		if (t4 > 0 && (ray->direction * t4 - co2).sqrLentgh() <= radius*radius)
+		if (t4 >= EPSILON && t4 < nearest && (ray->direction * t4 - co2).sqrLentgh() <= radius*radius)
 		{
-			points.push_back(t4);
+			nearest = t4;
 		}
 	}
 
-	float minT = INFINITY;
-	bool intersects = false;
-	for (int i = 0; i<points.size(); i++)
-	{
-		if (minT > points[i] && points[i] >= EPSILON)
-		{
-			minT = points[i];
-			intersects = true;
-		}
-	}
-
-	if (intersects && minT < ray->t)
-	{
-		ray->t = minT / ray->direction.length();
-		ray->intersectedObjectId = this->id;
-	}
+	return nearest;
 }
 
 vec3 Cylinder::getNormal(vec3 point)
@@ -267,7 +391,7 @@ void Cylinder::translate(vec3 vector)
 
 // -------------------- TORUS ------------------------------------
 
-Torus::Torus(Material* material, float R, float r, vec3 position, vec3 axis) : Primitive(material)
+Torus::Torus(Material* material, float R, float r, vec3 position, vec3 axis) : Primitive(material, torusPrimitive)
 {
 	this->position = position;
 	this->R = R;
@@ -279,48 +403,151 @@ Torus::Torus(Material* material, float R, float r, vec3 position, vec3 axis) : P
 
 void Torus::intersect(Ray* ray)
 {
-	vec3 centerToRayOrigin = ray->origin - position;
-	long double centerToRayOriginDotDirectionSquared = dot(centerToRayOrigin, centerToRayOrigin);
-	long double r2 = r * r;
-	long double R2 = R * R;
-
-	long double axisDotCenterToRayOrigin = dot(axis, centerToRayOrigin);
-	long double axisDotRayDirection = dot(axis, ray->direction);
-	long double a = 1 - axisDotRayDirection * axisDotRayDirection;
-	long double b = 2 * (dot(centerToRayOrigin, ray->direction) - axisDotCenterToRayOrigin * axisDotRayDirection);
-	long double c = centerToRayOriginDotDirectionSquared - axisDotCenterToRayOrigin * axisDotCenterToRayOrigin;
-	long double d = centerToRayOriginDotDirectionSquared + R2 - r2;
-
-	// Solve quartic equation with coefficients A, B, C, D and E
-	long double A = 1;
-	long double B = 4 * dot(ray->direction, centerToRayOrigin);
-	long double C = 2 * d + B * B * 0.25f - 4 * R2 * a;
-	long double D = B * d - 4 * R2 * b;
-	long double E = d * d - 4 * R2 * c;
-
-	// Maximum number of roots is 4
-	QuarticEquation equation(A, B, C, D, E);
-	const int maxRootsCount = 4;
-	double roots[maxRootsCount] = { -1.0, -1.0, -1.0, -1.0 };
-	int rootsCount = equation.Solve(roots);
-
-	if (rootsCount == 0) { return; }
-
-	// Find closest to zero positive solution
+	float t = this->calculateDistance(ray);
+	if (t < ray->t)
+	{
+		ray->t = t;
+		ray->intersectedObjectId = this->id;
+	}
+}
+
+bool Torus::occludes(Ray* ray)
+{
+	return this->calculateDistance(ray) < ray->t;
+}
+
+float Torus::calculateDistance(Ray* ray)
+{
+	// reject rays that miss the bounding sphere or only reach it beyond the closest hit so far
+	vec3 centerToRayOrigin = ray->origin - this->position;
+	float boundingRadius = this->R + this->r;
+	float b = dot(centerToRayOrigin, ray->direction);
+	float c = dot(centerToRayOrigin, centerToRayOrigin) - boundingRadius * boundingRadius;
+	float discriminant = b * b - c;
+	if (discriminant < 0) return INFINITY;
+
+	discriminant = sqrtf(discriminant);
+	float exit = -b + discriminant;
+	float entry = MAX(-b - discriminant, 0.0f);
+	if (exit < EPSILON || entry >= ray->t) return INFINITY;
+
+	// quartic in the distance from the entry point, starting next to the surface keeps float coefficients accurate
+	vec3 origin = centerToRayOrigin + ray->direction * entry;
+	float originDotOrigin = dot(origin, origin);
+	float r2 = this->r * this->r;
+	float R2 = this->R * this->R;
+
+	float axisDotOrigin = dot(this->axis, origin);
+	float axisDotRayDirection = dot(this->axis, ray->direction);
+	float e = 1 - axisDotRayDirection * axisDotRayDirection;
+	float f = 2 * (dot(origin, ray->direction) - axisDotOrigin * axisDotRayDirection);
+	float g = originDotOrigin - axisDotOrigin * axisDotOrigin;
+	float h = originDotOrigin + R2 - r2;
+
+	float B = 4 * dot(ray->direction, origin);
+	float C = 2 * h + B * B * 0.25f - 4 * R2 * e;
+	float D = B * h - 4 * R2 * f;
+	float E = h * h - 4 * R2 * g;
+
+	float roots[4];
+	int rootsCount = solveQuartic(B, C, D, E, roots);
+
 	float closestRoot = INFINITY;
-	for (int i = 0; i < maxRootsCount; ++i)
+	for (int i = 0; i < rootsCount; i++)
 	{
-		if (roots[i] >= EPSILON && roots[i] < closestRoot)
+		float t = entry + roots[i];
+		if (t >= EPSILON && t < closestRoot)
 		{
-			closestRoot = roots[i];
+			closestRoot = t;
 		}
 	}
 
-	if (closestRoot < ray->t)
+	return closestRoot;
+}
+
+int Torus::solveQuartic(float b, float c, float d, float e, float* roots)
+{
+	// Ferrari's method for x^4 + bx^3 + cx^2 + dx + e, on the depressed quartic y^4 + py^2 + qy + s with x = y - b / 4
+	float b2 = b * b;
+	float p = c - 0.375f * b2;
+	float q = d - 0.5f * b * c + 0.125f * b2 * b;
+	float s = e - 0.25f * b * d + 0.0625f * b2 * c - 0.01171875f * b2 * b2;
+
+	// largest root of the resolvent cubic m^3 + pm^2 + (p^2 / 4 - s)m - q^2 / 8, positive unless q is zero
+	float a2 = p, a1 = 0.25f * p * p - s, a0 = -0.125f * q * q;
+	float Q = (a2 * a2 - 3 * a1) / 9;
+	float R = (2 * a2 * a2 * a2 - 9 * a2 * a1 + 27 * a0) / 54;
+	float m;
+	if (R * R < Q * Q * Q)
 	{
-		ray->t = closestRoot;
-		ray->intersectedObjectId = this->id;
+		float theta = acosf(R / sqrtf(Q * Q * Q));
+		m = -2 * sqrtf(Q) * cosf((theta + 2 * PI) / 3) - a2 / 3;
+	}
+	else
+	{
+		float A = -copysignf(cbrtf(fabsf(R) + sqrtf(R * R - Q * Q * Q)), R);
+		m = A + (A != 0 ? Q / A : 0) - a2 / 3;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		float value = ((m + a2) * m + a1) * m + a0;
+		float derivative = (3 * m + 2 * a2) * m + a1;
+		if (derivative != 0) m -= value / derivative;
+	}
+
+	// the quartic factors into two quadratics in y
+	int count = 0, quadraticsCount = 0;
+	float quadratics[2][2]; // linear and constant coefficient
+	if (m > 1e-12f)
+	{
+		float root = sqrtf(2 * m);
+		float offset = q / (2 * root);
+		quadratics[0][0] = root; quadratics[0][1] = 0.5f * p + m - offset;
+		quadratics[1][0] = -root; quadratics[1][1] = 0.5f * p + m + offset;
+		quadraticsCount = 2;
+	}
+	else
+	{
+		// biquadratic, solve for y^2 and keep the non-negative solutions
+		float discriminant = p * p - 4 * s;
+		if (discriminant < 0) return 0;
+
+		discriminant = sqrtf(discriminant);
+		float z[2] = { 0.5f * (-p + discriminant), 0.5f * (-p - discriminant) };
+		for (int i = 0; i < 2; i++)
+		{
+			if (z[i] < 0) continue;
+			roots[count++] = sqrtf(z[i]);
+			roots[count++] = -sqrtf(z[i]);
+		}
+	}
+
+	for (int i = 0; i < quadraticsCount; i++)
+	{
+		float k = quadratics[i][0], l = quadratics[i][1];
+		float discriminant = k * k - 4 * l;
+		if (discriminant < 0) continue;
+
+		// numerically stable form, avoids cancellation in the smaller root
+		float u = -0.5f * (k + copysignf(sqrtf(discriminant), k));
+		roots[count++] = u;
+		roots[count++] = u != 0 ? l / u : 0;
+	}
+
+	// back to x and polish with Newton steps on the original quartic
+	for (int i = 0; i < count; i++)
+	{
+		float x = roots[i] - 0.25f * b;
+		for (int j = 0; j < 2; j++)
+		{
+			float value = (((x + b) * x + c) * x + d) * x + e;
+			float derivative = ((4 * x + 3 * b) * x + 2 * c) * x + d;
+			if (derivative != 0) x -= value / derivative;
+		}
+		roots[i] = x;
 	}
+
+	return count;
 }
 
 vec3 Torus::getNormal(vec3 point)
@@ -339,3 +566,66 @@ void Torus::translate(vec3 vector)
 	this->position += vector;
 	this->boundingBox->translate(vector);
 }
+
+// -------------------- PRIMITIVE ARRAYS ------------------------------------
+
+#define TYPE_SHIFT 28 // bits of the index within the array of a type in a reference
+
+size_t PrimitiveArrays::calculateMemoryUsage()
+{
+	return this->spheres.capacity() * sizeof(Sphere) + this->triangles.capacity() * sizeof(Triangle) + this->planes.capacity() * sizeof(Plane)
+		+ this->cylinders.capacity() * sizeof(Cylinder) + this->tori.capacity() * sizeof(Torus);
+}
+
+int PrimitiveArrays::add(Primitive* primitive)
+{
+	int index;
+	switch (primitive->type)
+	{
+	case spherePrimitive: index = this->spheres.size(); this->spheres.push_back(*(Sphere*)primitive); break;
+	case trianglePrimitive: index = this->triangles.size(); this->triangles.push_back(*(Triangle*)primitive); break;
+	case planePrimitive: index = this->planes.size(); this->planes.push_back(*(Plane*)primitive); break;
+	case cylinderPrimitive: index = this->cylinders.size(); this->cylinders.push_back(*(Cylinder*)primitive); break;
+	default: index = this->tori.size(); this->tori.push_back(*(Torus*)primitive); break;
+	}
+
+	return (primitive->type << TYPE_SHIFT) | index;
+}
+
+void PrimitiveArrays::intersect(int reference, Ray* ray)
+{
+	int index = reference & ((1 << TYPE_SHIFT) - 1);
+	switch (reference >> TYPE_SHIFT)
+	{
+	case spherePrimitive: this->spheres[index].intersect(ray); break;
+	case trianglePrimitive: this->triangles[index].intersect(ray); break;
+	case planePrimitive: this->planes[index].intersect(ray); break;
+	case cylinderPrimitive: this->cylinders[index].intersect(ray); break;
+	default: this->tori[index].intersect(ray); break;
+	}
+}
+
+bool PrimitiveArrays::occludes(int reference, Ray* ray)
+{
+	int index = reference & ((1 << TYPE_SHIFT) - 1);
+	switch (reference >> TYPE_SHIFT)
+	{
+	case spherePrimitive: return this->spheres[index].occludes(ray);
+	case trianglePrimitive: return this->triangles[index].occludes(ray);
+	case planePrimitive: return this->planes[index].occludes(ray);
+	case cylinderPrimitive: return this->cylinders[index].occludes(ray);
+	default: return this->tori[index].occludes(ray);
+	}
+}
+
+vec3 PrimitiveArrays::getNormal(Primitive* primitive, vec3 point)
+{
+	switch (primitive->type)
+	{
+	case spherePrimitive: return ((Sphere*)primitive)->getNormal(point);
+	case trianglePrimitive: return ((Triangle*)primitive)->getNormal(point);
+	case planePrimitive: return ((Plane*)primitive)->getNormal(point);
+	case cylinderPrimitive: return ((Cylinder*)primitive)->getNormal(point);
+	default: return ((Torus*)primitive)->getNormal(point);
+	}
+}
@@ -13,23 +13,27 @@ namespace Tmpl8 {
 	class Primitive
 	{
 	public:
-		Primitive(Material* material);
+		Primitive(Material* material, PrimitiveType type);
 		
 		int id;
+		PrimitiveType type; // lets hot loops call the final classes directly instead of through the vtable
 		Material* material;
 		BoundingBox* boundingBox;
 
 		virtual void intersect(Ray* ray) = 0;
+		virtual bool occludes(Ray* ray);
 		virtual vec3 getNormal(vec3 point) = 0;
 		virtual void translate(vec3 vector) = 0;
+		virtual void clip(const BoundingBox& bounds, int axis, float position, BoundingBox& left, BoundingBox& right);
 	};
 
-	class Sphere : public Primitive
+	class Sphere final : public Primitive
 	{
 	public:
 		Sphere(Material* material, vec3 position, float radius);
 
 		void intersect(Ray* ray);
+		bool occludes(Ray* ray);
 		vec3 getNormal(vec3 point);
 		void translate(vec3 vector);
 
@@ -38,26 +42,31 @@ namespace Tmpl8 {
 		float radius, radius2;
 	};
 
-	class Triangle : public Primitive
+	class Triangle final : public Primitive
 	{
 	public:
 		Triangle(Material* material, vec3 a, vec3 b, vec3 c);
 
 		void intersect(Ray* ray);
+		bool occludes(Ray* ray);
 		vec3 getNormal(vec3 point);
 		void translate(vec3 vector);
+		void clip(const BoundingBox& bounds, int axis, float position, BoundingBox& left, BoundingBox& right);
+
+		static void clip(vec3 a, vec3 b, vec3 c, const BoundingBox& bounds, int axis, float position, BoundingBox& left, BoundingBox& right);
 
 	private:
 		vec3 a, b, c;
 		vec3 normal;
 	};
 
-	class Plane : public Primitive
+	class Plane final : public Primitive
 	{
 	public:
 		Plane(Material* material, vec3 position, vec3 direction, float size = 10);
 
 		void intersect(Ray* ray);
+		bool occludes(Ray* ray);
 		vec3 getNormal(vec3 point);
 		void translate(vec3 vector);
 
@@ -65,32 +74,58 @@ namespace Tmpl8 {
 		vec3 position, direction;
 	};
 
-	class Cylinder : public Primitive
+	class Cylinder final : public Primitive
 	{
 	public:
 		Cylinder(Material* material, vec3 position, vec3 upVector, float radius, float height);
 
 		void intersect(Ray* ray);
+		bool occludes(Ray* ray);
 		vec3 getNormal(vec3 point);
 		void translate(vec3 vector);
 
 	private:
 		vec3 position, upVector;
 		float radius, height;
+
+		float calculateDistance(Ray* ray);
 	};
 
-	class Torus : public Primitive
+	class Torus final : public Primitive
 	{
 	public:
 		Torus(Material* material, float R, float r, vec3 position, vec3 axis);
 
 		void intersect(Ray* ray);
+		bool occludes(Ray* ray);
 		vec3 getNormal(vec3 point);
 		void translate(vec3 vector);
 
+		static int solveQuartic(float b, float c, float d, float e, float* roots);
+
 	private:
 		float R, r;
 		vec3 position, axis;
 
+		float calculateDistance(Ray* ray);
+	};
+
+	// copies of primitives grouped into one contiguous array per type. A reference holds the type in its top bits and
+	// the index within the array of that type below, tests are dispatched with a switch so the kernels can be inlined.
+	class PrimitiveArrays
+	{
+	public:
+		std::vector<Sphere> spheres;
+		std::vector<Triangle> triangles;
+		std::vector<Plane> planes;
+		std::vector<Cylinder> cylinders;
+		std::vector<Torus> tori;
+
+		int add(Primitive* primitive);
+		void intersect(int reference, Ray* ray);
+		bool occludes(int reference, Ray* ray);
+		size_t calculateMemoryUsage();
+
+		static vec3 getNormal(Primitive* primitive, vec3 point);
 	};
 }
@@ -0,0 +1,11 @@
+#include "precomp.h"
+
+void RandomGenerator::seed(unsigned long long state, unsigned long long sequence)
+{
+	// the sequence selects one of 2^63 streams, the state the position within it
+	this->state = 0;
+	this->increment = (sequence << 1) | 1;
+	this->next();
+	this->state += state;
+	this->next();
+}
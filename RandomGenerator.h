@@ -0,0 +1,31 @@
+#pragma once
+namespace Tmpl8
+{
+	// PCG32 generator, 16 bytes of state. Every path gets its own generator seeded from its pixel and the frame,
+	// so renders are deterministic and threads share no random state.
+	class RandomGenerator
+	{
+	public:
+		void seed(unsigned long long state, unsigned long long sequence);
+
+		unsigned int next()
+		{
+			unsigned long long oldState = this->state;
+			this->state = oldState * 6364136223846793005ULL + this->increment;
+
+			unsigned int xorShifted = (unsigned int)(((oldState >> 18) ^ oldState) >> 27);
+			unsigned int rotation = (unsigned int)(oldState >> 59);
+
+			return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+		}
+
+		// uniform in [0, 1), from the upper 24 bits so every value is exact in a float
+		float uniform() { return (this->next() >> 8) * (1.0f / 16777216.0f); }
+
+		// uniform in [0, count)
+		int uniform(int count) { return (int)(((unsigned long long)this->next() * count) >> 32); }
+
+	private:
+		unsigned long long state, increment;
+	};
+}
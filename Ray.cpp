@@ -16,6 +16,7 @@ void Ray::create(vec3 origin, vec3 direction)
 
 	this->t = INFINITY;
 	this->intersectedObjectId = -1;
+	this->instanceId = -1;
 	this->lightIntersected = false;
 
 	this->invertedDirection = vec3(1.0f / this->direction.x, 1.0f / this->direction.y, 1.0f / this->direction.z);
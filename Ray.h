@@ -11,6 +11,7 @@ namespace Tmpl8 {
 		vec3 direction, invertedDirection;
 		float t;
 		int intersectedObjectId;
+		int instanceId; // instance the intersected object belongs to
 		bool lightIntersected;
 
 		void create(vec3 origin, vec3 direction);
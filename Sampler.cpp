@@ -0,0 +1,115 @@
+#include "precomp.h"
+
+#define PLASTIC_NUMBER 1.32471795724474602596 // generalized golden ratio of the R2 sequence
+
+static unsigned int hashInteger(unsigned int x)
+{
+	// integer finalizer of lowbias32
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+
+	return x;
+}
+
+static unsigned int reverseBits(unsigned int x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffU) << 8) | ((x & 0xff00ff00U) >> 8);
+	x = ((x & 0x0f0f0f0fU) << 4) | ((x & 0xf0f0f0f0U) >> 4);
+	x = ((x & 0x33333333U) << 2) | ((x & 0xccccccccU) >> 2);
+	x = ((x & 0x55555555U) << 1) | ((x & 0xaaaaaaaaU) >> 1);
+
+	return x;
+}
+
+static unsigned int owenScramble(unsigned int x, unsigned int seed)
+{
+	// hash based Owen scrambling (Burley 2020): a Laine-Karras permutation on the reversed bits only lets
+	// every bit depend on the bits above it
+	x = reverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cU;
+	x ^= x * 0xb82f1e52U;
+	x ^= x * 0xc7afe638U;
+	x ^= x * 0x8d22f6e6U;
+
+	return reverseBits(x);
+}
+
+static float toFloat(unsigned int x)
+{
+	// upper 24 bits, so the result stays below 1
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+void Sampler::start(SamplerType type, int pixelX, int pixelY, int sampleIndex)
+{
+	this->type = type;
+	this->index = sampleIndex;
+	this->seed = hashInteger(pixelX + pixelY * SCRWIDTH + 1);
+	this->bounce = 0;
+
+	// R2 dithering of the screen distributes the offsets of neighbouring pixels as blue noise
+	this->offsetX = fmodf(pixelX * (float)(1 / PLASTIC_NUMBER) + pixelY * (float)(1 / (PLASTIC_NUMBER * PLASTIC_NUMBER)), 1.0f);
+	this->offsetY = fmodf(pixelX * (float)(1 / (PLASTIC_NUMBER * PLASTIC_NUMBER)) + pixelY * (float)(1 / PLASTIC_NUMBER), 1.0f);
+
+	this->random.seed(sampleIndex, (unsigned long long)(pixelX + pixelY * SCRWIDTH));
+}
+
+float Sampler::get(int dimension)
+{
+	float u, v;
+	this->sample(1 + this->bounce * Sampler::BOUNCE_DIMENSIONS + dimension, u, v);
+
+	return u;
+}
+
+void Sampler::get(int dimension, float& u, float& v)
+{
+	this->sample(1 + this->bounce * Sampler::BOUNCE_DIMENSIONS + dimension, u, v);
+}
+
+void Sampler::getPixel(float& u, float& v)
+{
+	this->sample(0, u, v);
+}
+
+void Sampler::sample(int pair, float& u, float& v)
+{
+	if (this->type == randomSampler)
+	{
+		u = this->random.uniform();
+		v = this->random.uniform();
+		return;
+	}
+
+	if (this->type == sobolSampler)
+	{
+		unsigned int pairSeed = hashInteger(this->seed ^ hashInteger(pair));
+
+		// first two Sobol dimensions, every dimension pair shuffles the sample order and scrambles its values independently
+		unsigned int index = owenScramble(this->index, pairSeed);
+
+		unsigned int x = reverseBits(index);
+		unsigned int y = 0;
+		for (unsigned int direction = 1U << 31; index != 0; index >>= 1, direction ^= direction >> 1)
+		{
+			if (index & 1) y ^= direction;
+		}
+
+		u = toFloat(owenScramble(x, hashInteger(pairSeed ^ 0x9e3779b9U)));
+		v = toFloat(owenScramble(y, hashInteger(pairSeed ^ 0x7f4a7c15U)));
+		return;
+	}
+
+	// rank-1 lattice of the R2 sequence, rotated by the blue noise offset of the pixel. The sample order is shuffled
+	// per pair to decorrelate the pairs, the same way for all pixels so neighbouring pixels keep their blue noise offsets
+	unsigned int index = owenScramble(this->index, hashInteger(pair));
+	float stepX = (float)fmod(index * (1 / PLASTIC_NUMBER), 1.0);
+	float stepY = (float)fmod(index * (1 / (PLASTIC_NUMBER * PLASTIC_NUMBER)), 1.0);
+	u = fmodf(this->offsetX + stepX, 1.0f);
+	v = fmodf(this->offsetY + stepY, 1.0f);
+}
@@ -0,0 +1,33 @@
+#pragma once
+namespace Tmpl8
+{
+	// sample values of one path. Dimensions are assigned by purpose: the pixel position first, then the same
+	// layout for every bounce, so the low-discrepancy samplers stratify each decision of the path separately.
+	class Sampler
+	{
+	public:
+		// dimensions within a bounce
+		static const int ROULETTE = 0;
+		static const int LIGHT_CHOICE = 1;
+		static const int LIGHT_POINT = 2; // 2 dimensions
+		static const int BSDF = 4; // 2 dimensions, dielectrics choose between reflection and refraction with the first
+		static const int BOUNCE_DIMENSIONS = 6;
+
+		void start(SamplerType type, int pixelX, int pixelY, int sampleIndex);
+		void nextBounce() { this->bounce++; }
+
+		float get(int dimension);
+		void get(int dimension, float& u, float& v);
+		void getPixel(float& u, float& v);
+
+	private:
+		SamplerType type;
+		unsigned int index; // sample index within the pixel
+		unsigned int seed; // decorrelates pixels
+		float offsetX, offsetY; // blue noise offset of the pixel for the rank-1 lattice
+		int bounce;
+		RandomGenerator random;
+
+		void sample(int pair, float& u, float& v);
+	};
+}
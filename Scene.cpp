@@ -1,5 +1,7 @@
 #include "precomp.h"
 
+#define MAX_PATH_DEPTH 64 // bounces, only reached by paths between surfaces russian roulette never kills
+
 Scene::Scene(Surface* screen)
 {
 	// create camera
@@ -7,53 +9,158 @@ Scene::Scene(Surface* screen)
 	this->camera = new Camera();
 
 	this->topBVHExists = false;
+	this->batching = false;
+	this->batchStart = 0;
 	this->skydomeLoaded = false;
+	this->samplerType = sobolSampler;
+	this->topBVHBuildTime = 0;
 
 	this->resetAccumulator();
-
-	// set up random numbers generator
-	this->randomNumbersGenerator = std::mt19937(
-		std::chrono::system_clock::now().time_since_epoch().count()
-	);
+	this->resetRayCounters();
 }
 
-void Scene::render(int row)
+void Scene::render(int left, int top, int width, int height)
 {
-	for (int x = 0; x < SCRWIDTH; x++)
+	if (WAVEFRONT_ENABLED)
 	{
-		// divide pixel into strata
-		vec4 color = vec4(0);
-		for (int i = 0; i < STRATA_SIZE; i++)
+		this->renderWavefront(left, top, width, height);
+		return;
+	}
+
+	RayCounters rayCounters = { 0, 0, 0 };
+	for (int row = top; row < top + height; row++)
+	{
+		for (int x = left; x < left + width; x++)
 		{
-			for (int j = 0; j < STRATA_SIZE; j++)
+			// divide pixel into strata
+			vec4 color = vec4(0);
+			for (int stratum = 0; stratum < STRATA_SIZE * STRATA_SIZE; stratum++)
 			{
-				std::uniform_real_distribution<double> uniformGenerator01(0.0, STRATA_WIDTH - EPSILON);
-				float randomX = uniformGenerator01(this->randomNumbersGenerator) + j * STRATA_WIDTH;
-				float randomY = uniformGenerator01(this->randomNumbersGenerator) + i * STRATA_WIDTH;
+				Sampler sampler;
+				Ray* ray = this->generateRay(x, row, stratum, sampler);
+
+				color += this->sample(ray, sampler, rayCounters);
+			}
+
+			int pixelId = row * SCRWIDTH + x;
+			this->accumulator[pixelId] += color * (STRATA_WIDTH * STRATA_WIDTH);
+
+			// plot pixel with color
+			this->screen->Plot(x, row, this->convertColorToPixel(this->accumulator[pixelId] * this->inversedAccumulatorCounter));
+		}
+	}
+
+	this->primaryRays += rayCounters.primary;
+	this->secondaryRays += rayCounters.secondary;
+	this->shadowRays += rayCounters.shadow;
+}
 
-				Ray* ray = this->camera->generateRay(x + randomX, row + randomY);
+void Scene::renderWavefront(int left, int top, int width, int height)
+{
+	// all paths of the tile advance together one stage at a time, every stage is a loop over the path buffers
+	const int pathsCount = width * height * STRATA_SIZE * STRATA_SIZE;
+	static thread_local WavefrontBuffers buffers;
+	buffers.reserve(pathsCount);
+
+	Ray* rays = &buffers.rays[0];
+	vec4* colors = &buffers.colors[0];
+	vec4* throughputs = &buffers.throughputs[0];
+	char* specular = &buffers.specular[0];
+	ShadowRay* shadowRays = &buffers.shadowRays[0];
+	Sampler* samplers = &buffers.samplers[0];
+	int* activePaths = &buffers.activePaths[0];
+
+	// generate, the paths of a pixel are consecutive
+	for (int i = 0, path = 0; i < width * height; i++)
+	{
+		for (int stratum = 0; stratum < STRATA_SIZE * STRATA_SIZE; stratum++, path++)
+		{
+			rays[path] = *this->generateRay(left + i % width, top + i / width, stratum, samplers[path]);
+			colors[path] = vec4(0);
+			throughputs[path] = vec4(1);
+			specular[path] = true;
+			activePaths[path] = path;
+		}
+	}
 
-				color += this->sample(ray, true);
-				/*if (x < SCRWIDTH / 2)
+	int activeCount = pathsCount;
+	RayCounters rayCounters = { pathsCount, 0, 0 };
+	for (int depth = 0; depth < MAX_PATH_DEPTH && activeCount > 0; depth++)
+	{
+		if (depth > 0) rayCounters.secondary += activeCount;
+
+		// extend
+		for (int i = 0; i < activeCount; i++)
+		{
+			Ray* ray = &rays[activePaths[i]];
+			this->intersectPrimitives(ray);
+			this->intersectLightSources(ray);
+		}
+
+		// shade, terminated paths are compacted out of the active list
+		int survivorsCount = 0;
+		for (int i = 0; i < activeCount; i++)
+		{
+			int path = activePaths[i];
+			bool isSpecular = specular[path] != 0;
+			if (this->extendPath(&rays[path], colors[path], throughputs[path], isSpecular, shadowRays[path], samplers[path]))
+			{
+				samplers[path].nextBounce();
+				activePaths[survivorsCount++] = path;
+			}
+			specular[path] = isSpecular;
+		}
+		activeCount = survivorsCount;
+
+		// shadow
+		for (int i = 0; i < activeCount; i++)
+		{
+			ShadowRay& shadowRay = shadowRays[activePaths[i]];
+			if (shadowRay.distance > 0)
+			{
+				rayCounters.shadow++;
+				if (!this->occluded(shadowRay.origin, shadowRay.direction, shadowRay.distance))
 				{
-					color += this->sampleNEE(ray, 0);
+					colors[activePaths[i]] += shadowRay.contribution;
 				}
-				else
-				{
-					color += this->sample(ray, true);
-				}*/
-				//delete ray;
 			}
 		}
-		
+	}
+
+	this->primaryRays += rayCounters.primary;
+	this->secondaryRays += rayCounters.secondary;
+	this->shadowRays += rayCounters.shadow;
+
+	// accumulate
+	for (int i = 0; i < width * height; i++)
+	{
+		vec4 color = vec4(0);
+		for (int path = i * STRATA_SIZE * STRATA_SIZE; path < (i + 1) * STRATA_SIZE * STRATA_SIZE; path++)
+		{
+			color += colors[path];
+		}
+
+		int x = left + i % width, row = top + i / width;
 		int pixelId = row * SCRWIDTH + x;
 		this->accumulator[pixelId] += color * (STRATA_WIDTH * STRATA_WIDTH);
 
-		// plot pixel with color
-		this->screen->Plot(x, row, this->convertColorToPixel(this->accumulator[pixelId] * this->inversedAccumulatorCounter));		
+		this->screen->Plot(x, row, this->convertColorToPixel(this->accumulator[pixelId] * this->inversedAccumulatorCounter));
 	}
 }
 
+void Scene::WavefrontBuffers::reserve(int pathsCount)
+{
+	if (this->rays.size() >= pathsCount) return;
+
+	this->rays.resize(pathsCount);
+	this->colors.resize(pathsCount);
+	this->throughputs.resize(pathsCount);
+	this->specular.resize(pathsCount);
+	this->shadowRays.resize(pathsCount);
+	this->samplers.resize(pathsCount);
+	this->activePaths.resize(pathsCount);
+}
+
 void Scene::increaseAccumulator()
 {
 	this->accumulatorCounter++;
@@ -70,84 +177,148 @@ void Scene::resetAccumulator()
 	this->accumulatorCounter = 0;
 }
 
-vec4 Scene::sample(Ray* ray, bool isLastPrimitiveSpecular)
+void Scene::setSampler(SamplerType samplerType)
+{
+	this->samplerType = samplerType;
+	this->resetAccumulator();
+}
+
+Ray* Scene::generateRay(int x, int row, int stratum, Sampler& sampler)
 {
-	this->intersectPrimitives(ray);
-	this->intersectLightSources(ray);
+	// paths get the same samples in both render modes, given the pixel, stratum and frame
+	int sampleIndex = MAX(this->accumulatorCounter - 1, 0) * STRATA_SIZE * STRATA_SIZE + stratum;
+	sampler.start(this->samplerType, x, row, sampleIndex);
 
-	if (ray->intersectedObjectId == -1) // no primitive intersected
+	float u, v;
+	sampler.getPixel(u, v);
+	if (this->samplerType == randomSampler)
 	{
-		return this->skydomeLoaded ? this->sampleSkydome(ray) : BGCOLOR;
+		// independent samples are jittered within their stratum, the low discrepancy samplers stratify by themselves
+		int i = stratum / STRATA_SIZE, j = stratum % STRATA_SIZE;
+		u = u * (STRATA_WIDTH - EPSILON) + j * STRATA_WIDTH;
+		v = v * (STRATA_WIDTH - EPSILON) + i * STRATA_WIDTH;
 	}
 
-	if (ray->lightIntersected)
+	return this->camera->generateRay(x + u, row + v);
+}
+
+vec4 Scene::sample(Ray* ray, Sampler& sampler, RayCounters& rayCounters)
+{
+	// iterative path tracer, the state of the path is carried through the loop instead of the call stack
+	Ray pathRay = *ray;
+	vec4 color = vec4(0), throughput = vec4(1);
+	bool specular = true;
+	ShadowRay shadowRay;
+
+	for (int depth = 0; depth < MAX_PATH_DEPTH; depth++)
 	{
-		if (isLastPrimitiveSpecular)
+		this->intersectPrimitives(&pathRay);
+		this->intersectLightSources(&pathRay);
+		if (depth == 0) rayCounters.primary++;
+		else rayCounters.secondary++;
+
+		bool survives = this->extendPath(&pathRay, color, throughput, specular, shadowRay, sampler);
+
+		if (shadowRay.distance > 0)
 		{
-			return this->lightSources[ray->intersectedObjectId]->color * this->lightSources[ray->intersectedObjectId]->intensity;
+			rayCounters.shadow++;
+			if (!this->occluded(shadowRay.origin, shadowRay.direction, shadowRay.distance))
+			{
+				color += shadowRay.contribution;
+			}
 		}
 
-		return BGCOLOR;
+		if (!survives) break;
+		sampler.nextBounce();
+	}
+
+	return color;
+}
+
+bool Scene::extendPath(Ray* ray, vec4& color, vec4& throughput, bool& specular, ShadowRay& shadowRay, Sampler& sampler)
+{
+	// shades the intersection of ray and replaces it with the next ray of the path, returns false when the path ends
+	shadowRay.distance = 0;
+
+	if (ray->intersectedObjectId == -1) // no primitive intersected
+	{
+		color += throughput * (this->skydomeLoaded ? this->sampleSkydome(ray) : BGCOLOR);
+		return false;
+	}
+
+	if (ray->lightIntersected)
+	{
+		// lights hit after diffuse bounces are already counted by next event estimation
+		LightSource* light = this->lightSources[ray->intersectedObjectId];
+		color += throughput * (specular ? light->color * light->intensity : BGCOLOR);
+		return false;
 	}
 
 	// primitive intersected
-	Material* material = this->primitives[ray->intersectedObjectId]->material;
+	Material* material = this->getIntersectedMaterial(ray);
 
 	// kill random rays by russian roullete
-	std::uniform_real_distribution<double> uniformGenerator01(0.0, 1.0);
-	float randomNumber = uniformGenerator01(this->randomNumbersGenerator);
-	float raySurviveProbability = min(1, max(max(material->color.x, material->color.y), material->color.z));
+	float randomNumber = sampler.get(Sampler::ROULETTE);
+	float raySurviveProbability = min(1.0f, max(max(material->color.x, material->color.y), material->color.z));
 	if (material->type == dielectric)
 	{
 		raySurviveProbability = min(raySurviveProbability, 0.5f);
 	}
-	float energyMultiplier = 1 / raySurviveProbability;
 	if (randomNumber > raySurviveProbability)
 	{
-		return BGCOLOR;
+		color += throughput * BGCOLOR;
+		return false;
 	}
+	throughput *= 1 / raySurviveProbability;
 
 	if (material->type == diffuse)
 	{
-		return illuminate(ray) * energyMultiplier;
+		vec3 hitPoint = ray->origin + ray->t * ray->direction;
+		vec3 primitiveNormal = this->getIntersectedNormal(ray, hitPoint);
+		vec4 BRDF = material->color * INVERSEPI;
+
+		this->sampleLight(hitPoint, primitiveNormal, BRDF, shadowRay, sampler);
+		shadowRay.contribution = throughput * shadowRay.contribution;
+
+		Ray diffuseReflectionRay = this->computeDiffuseReflectionRay(ray, sampler);
+		float PDF = PI / dot(primitiveNormal, diffuseReflectionRay.direction);  // Importance Sampling
+		//float PDF = (2 * PI);
+
+		throughput = throughput * (dot(primitiveNormal, diffuseReflectionRay.direction) * PDF) * BRDF;
+		specular = false;
+		*ray = diffuseReflectionRay;
+
+		return true;
 	}
 	if (material->type == mirror)
 	{
-		Ray* reflectionRay = computeReflectionRay(ray);
-		vec4 reflectionColor = this->sample(reflectionRay, true);
-		delete reflectionRay;
+		throughput = throughput * material->color;
+		specular = true;
+		*ray = this->computeReflectionRay(ray);
 
-		return material->color * reflectionColor * energyMultiplier;
+		return true;
 	}
 	if (material->type == dielectric)
 	{
-		std::uniform_real_distribution<double> uniformGenerator01(0.0, 1.0);
-		float randomNumber = uniformGenerator01(this->randomNumbersGenerator);
+		float randomNumber = sampler.get(Sampler::BSDF);
 		float refractionProbability = this->calculateRefractionProbability(ray);
 
-		if (randomNumber > refractionProbability)
+		Ray nextRay = randomNumber > refractionProbability ? this->computeRefractionRay(ray) : this->computeReflectionRay(ray);
+		if (nextRay.intersectedObjectId == -2)
 		{
-			Ray* refractionRay = this->computeRefractionRay(ray);
-			if (refractionRay->intersectedObjectId == -2)
-			{
-				delete refractionRay;
-				return BGCOLOR;
-			}
-
-			vec4 refractionColor = this->sample(refractionRay, true) * material->color;
-			delete refractionRay;
-
-			return refractionColor * energyMultiplier;
+			color += throughput * BGCOLOR;
+			return false;
 		}
 
-		Ray* reflectionRay = this->computeReflectionRay(ray);
-		vec4 reflectionColor = this->sample(reflectionRay, true) * material->color;
-		delete reflectionRay;
+		throughput = throughput * material->color;
+		specular = true;
+		*ray = nextRay;
 
-		return reflectionColor * energyMultiplier;
+		return true;
 	}
 
-	return BGCOLOR;
+	color += throughput * BGCOLOR;
+	return false;
 }
 
 vec4 Scene::sampleSkydome(Ray* ray)
@@ -159,58 +330,40 @@ vec4 Scene::sampleSkydome(Ray* ray)
 	return this->skydome->buffer[pixel];
 }
 
-vec4 Scene::illuminate(Ray* ray)
+void Scene::sampleLight(vec3 hitPoint, vec3 primitiveNormal, vec4 BRDF, ShadowRay& shadowRay, Sampler& sampler)
 {
-	vec3 hitPoint = ray->origin + ray->t * ray->direction;
-
-	Primitive* intersectedPrimitive = this->primitives[ray->intersectedObjectId];
-	vec3 primitiveNormal = intersectedPrimitive->getNormal(hitPoint);
-
-	std::uniform_int_distribution<int> randomLightUniformGenerator(0, this->lightSources.size() - 1);
-	int randomLightIndex = randomLightUniformGenerator(this->randomNumbersGenerator);
+	// next event estimation towards a random point on a random light, the shadow ray is left unset when the light faces away
+	int lightsCount = this->lightSources.size();
+	int randomLightIndex = MIN((int)(sampler.get(Sampler::LIGHT_CHOICE) * lightsCount), lightsCount - 1);
 	LightSource* randomLight = this->lightSources[randomLightIndex];
 
-	vec3 lightDirection = randomLight->getRandomPointOnLight(this->randomNumbersGenerator) - hitPoint;
+	float u, v;
+	sampler.get(Sampler::LIGHT_POINT, u, v);
+	vec3 lightDirection = randomLight->getPointOnLight(u, v) - hitPoint;
 	float distanceToLightSquared = lightDirection.sqrLentgh();
 	lightDirection = normalize(lightDirection);
 
 	float lightNormalDotLightDirection = dot(randomLight->getNormal(hitPoint), -lightDirection);
 	float primitiveNormalDotLightDirection = dot(primitiveNormal, lightDirection);
 
-	vec4 directIlluminationColor = vec4(0, 0, 0, 1);
-	vec4 BRDF = intersectedPrimitive->material->color * INVERSEPI;
 	if (lightNormalDotLightDirection > 0 && primitiveNormalDotLightDirection > 0)
 	{
 		// light is not behind surface point, trace shadow ray
-		Ray* shadowRay = new Ray(hitPoint + EPSILON * lightDirection, lightDirection);
-		shadowRay->t = sqrt(distanceToLightSquared) - 2 * EPSILON;
-		this->intersectPrimitives(shadowRay, true);
+		float solidAngle = CLAMP((lightNormalDotLightDirection * randomLight->getArea()) / distanceToLightSquared, 0, 1);
 
-		if (shadowRay->intersectedObjectId == -1)
-		{
-			float solidAngle = CLAMP((lightNormalDotLightDirection * randomLight->getArea()) / distanceToLightSquared, 0, 1);
-			directIlluminationColor = randomLight->color * randomLight->intensity * solidAngle * BRDF * primitiveNormalDotLightDirection;
-		}
-		delete shadowRay;
+		shadowRay.origin = hitPoint + EPSILON * lightDirection;
+		shadowRay.direction = lightDirection;
+		shadowRay.distance = sqrt(distanceToLightSquared) - 2 * EPSILON;
+		shadowRay.contribution = randomLight->color * randomLight->intensity * solidAngle * BRDF * primitiveNormalDotLightDirection;
 	}
-
-	Ray* diffuseReflectionRay = this->computeDiffuseReflectionRay(ray);
-	float PDF = PI / dot(primitiveNormal, diffuseReflectionRay->direction);  // Importance Sampling
-	//float PDF = (2 * PI);
-
-	vec4 indirectIlluminationColor = this->sample(diffuseReflectionRay, false) * dot(primitiveNormal, diffuseReflectionRay->direction) * PDF * BRDF;
-	delete diffuseReflectionRay;
-
-	return directIlluminationColor + indirectIlluminationColor;
 }
 
-Ray* Scene::computeDiffuseReflectionRay(Ray* ray)
+Ray Scene::computeDiffuseReflectionRay(Ray* ray, Sampler& sampler)
 {
 	vec3 hitPoint = ray->origin + ray->t * ray->direction;
 
-	std::uniform_real_distribution<double> uniformGenerator01(0.0, 1.0);
-	float random1 = uniformGenerator01(this->randomNumbersGenerator);
-	float random2 = uniformGenerator01(this->randomNumbersGenerator);
+	float random1, random2;
+	sampler.get(Sampler::BSDF, random1, random2);
 
 	float angle = 2 * PI * random2;
 	//float r = sqrt(1 - random1 * random1);
@@ -220,35 +373,35 @@ Ray* Scene::computeDiffuseReflectionRay(Ray* ray)
 	float r = sqrt(random1);
 	vec3 direction = vec3(cosf(angle) * r, sinf(angle) * r, sqrt(1 - random1));
 
-	if (dot(this->primitives[ray->intersectedObjectId]->getNormal(hitPoint), direction) < 0)
+	if (dot(this->getIntersectedNormal(ray, hitPoint), direction) < 0)
 	{
 		direction *= -1.0f;
 	}
 
-	return new Ray(hitPoint + direction * EPSILON, direction);
+	return Ray(hitPoint + direction * EPSILON, direction);
 }
 
-Ray* Scene::computeReflectionRay(Ray* ray)
+Ray Scene::computeReflectionRay(Ray* ray)
 {
 	vec3 hitPoint = ray->origin + ray->t * ray->direction;
-	vec3 N = this->primitives[ray->intersectedObjectId]->getNormal(hitPoint);
+	vec3 N = this->getIntersectedNormal(ray, hitPoint);
 
 	vec3 direction = ray->direction - 2 * (ray->direction * N) * N;
 	vec3 origin = hitPoint + direction * EPSILON;
 
-	return new Ray(origin, direction);
+	return Ray(origin, direction);
 }
 
-Ray* Scene::computeRefractionRay(Ray* ray)
+Ray Scene::computeRefractionRay(Ray* ray)
 {
 	// source: https://www.scratchapixel.com/lessons/3d-basic-rendering/introduction-to-shading/reflection-refraction-fresnel
 
 	vec3 hitPoint = ray->origin + ray->t * ray->direction;
-	vec3 N = this->primitives[ray->intersectedObjectId]->getNormal(hitPoint);
+	vec3 N = this->getIntersectedNormal(ray, hitPoint);
 	float incommingAngle = dot(N, ray->direction);
 
 	float cosi = CLAMP(-1, 1, incommingAngle);
-	float etai = 1, etat = this->primitives[ray->intersectedObjectId]->material->refraction;
+	float etai = 1, etat = this->getIntersectedMaterial(ray)->refraction;
 	vec3 n = N;
 	if (cosi < 0) { cosi = -cosi; }
 	else { swap(etai, etat); n = -N; }
@@ -257,8 +410,8 @@ Ray* Scene::computeRefractionRay(Ray* ray)
 
 	if (k < 0)
 	{
-		Ray* refractionRay = new Ray(vec3(0), vec3(0));
-		refractionRay->intersectedObjectId = -2;
+		Ray refractionRay(vec3(0), vec3(0));
+		refractionRay.intersectedObjectId = -2;
 		return refractionRay;
 	}
 	else
@@ -270,17 +423,16 @@ Ray* Scene::computeRefractionRay(Ray* ray)
 		vec3 bias = EPSILON * N;
 		vec3 origin = outside ? hitPoint - bias : hitPoint + bias;
 
-		return new Ray(origin, direction);
+		return Ray(origin, direction);
 	}
 }
 
 float Scene::calculateRefractionProbability(Ray* ray)
 {
 	vec3 hitPoint = ray->origin + ray->direction * ray->t;
-	Primitive* intersectedPrimitive = this->primitives[ray->intersectedObjectId];
 
-	float cosi = CLAMP(-1, 1, hitPoint.dot(intersectedPrimitive->getNormal(hitPoint)));
-	float etai = 1, etat = intersectedPrimitive->material->refraction;
+	float cosi = CLAMP(-1, 1, hitPoint.dot(this->getIntersectedNormal(ray, hitPoint)));
+	float etai = 1, etat = this->getIntersectedMaterial(ray)->refraction;
 	if (cosi > 0) { std::swap(etai, etat); }
 
 	float sint = etai / etat * sqrtf(max(0.f, 1 - cosi * cosi));
@@ -302,21 +454,40 @@ float Scene::calculateRefractionProbability(Ray* ray)
 	return refractionProbability;
 }
 
-void Scene::intersectPrimitives(Ray* ray, bool isShadowRay)
+void Scene::intersectPrimitives(Ray* ray)
 {
 	if (BVH_ENABLED)
 	{
-		this->topBHV->traverse(this->topBHV->root, ray, isShadowRay);
+		this->topBHV->traverse(ray);
 	}
 	else
 	{
-		for (int i = 0; i < this->primitives.size(); i++)
+		for (int i = 0; i < this->instances.size(); i++)
 		{
-			this->primitives[i]->intersect(ray);
+			this->instances[i]->intersect(ray, this->primitives);
 		}
 	}
 }
 
+bool Scene::occluded(vec3 origin, vec3 direction, float tmax)
+{
+	Ray shadowRay(origin, direction);
+	shadowRay.t = tmax;
+
+	if (BVH_ENABLED)
+	{
+		return this->topBHV->occluded(&shadowRay);
+	}
+
+	for (int i = 0; i < this->instances.size(); i++)
+	{
+		if (this->instances[i]->occludes(&shadowRay, this->primitives))
+			return true;
+	}
+
+	return false;
+}
+
 void Scene::intersectLightSources(Ray* ray)
 {
 	for (int i = 0; i < this->lightSources.size(); i++)
@@ -325,11 +496,42 @@ void Scene::intersectLightSources(Ray* ray)
 	}
 }
 
+Material* Scene::getIntersectedMaterial(Ray* ray)
+{
+	Instance* instance = this->instances[ray->instanceId];
+	if (instance->material != NULL)
+	{
+		return instance->material;
+	}
+
+	return instance->bvh->mesh != NULL ? instance->bvh->mesh->material : this->primitives[ray->intersectedObjectId]->material;
+}
+
+vec3 Scene::getIntersectedNormal(Ray* ray, vec3 hitPoint)
+{
+	// intersected object ids are triangle indices for meshes, primitive ids otherwise
+	Instance* instance = this->instances[ray->instanceId];
+	if (instance->bvh->mesh != NULL)
+	{
+		vec3 normal = instance->bvh->mesh->getNormal(ray->intersectedObjectId);
+		return instance->identity ? normal : instance->toWorldNormal(normal);
+	}
+
+	Primitive* primitive = this->primitives[ray->intersectedObjectId];
+	if (instance->identity)
+	{
+		return PrimitiveArrays::getNormal(primitive, hitPoint);
+	}
+
+	// primitives of transformed instances are in object space
+	return instance->toWorldNormal(PrimitiveArrays::getNormal(primitive, instance->toObjectPoint(hitPoint)));
+}
+
 Pixel Scene::convertColorToPixel(vec4 color)
 {
-	int r = (int)min(256.0f * BRIGHTNESS * sqrt(color.x), 255);
-	int g = (int)min(256.0f * BRIGHTNESS * sqrt(color.y), 255);
-	int b = (int)min(256.0f * BRIGHTNESS * sqrt(color.z), 255);
+	int r = (int)min(256.0f * BRIGHTNESS * sqrt(color.x), 255.0f);
+	int g = (int)min(256.0f * BRIGHTNESS * sqrt(color.y), 255.0f);
+	int b = (int)min(256.0f * BRIGHTNESS * sqrt(color.z), 255.0f);
 
 	return (r << 16) + (g << 8) + b;
 }
@@ -339,34 +541,96 @@ void Scene::buildTopBVH()
 	if (this->topBVHExists)
 		delete this->topBHV;
 
-	this->topBHV = new TopBVH(this->primitives, this->BVHs);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	this->topBHV = new TopBVH(this->primitives, this->instances);
 	this->topBVHExists = true;
+	this->topBVHBuildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
-int Scene::buildBVH(int startIndex, int endIndex)
+void Scene::refitTopBVH()
 {
-	int id = this->BVHs.size();
+	if (this->batching)
+		return;
 
-	BVH* tree = new BVH(this->primitives);
-	tree->build(id, startIndex, endIndex);
-	this->BVHs.push_back(tree);
+	if (!this->topBVHExists || !this->topBHV->refit())
+		this->buildTopBVH();
+}
+
+void Scene::beginBatch()
+{
+	this->batching = true;
+	this->batchStart = this->primitives.size();
+}
+
+int Scene::commitBatch()
+{
+	// batched primitives are consecutive in the scene, one BVH over their range replaces a BVH per primitive
+	int id = -1;
+	if (this->batchStart < this->primitives.size())
+	{
+		BVH* bvh = this->buildBVH(this->batchStart, this->primitives.size() - 1);
+		bvh->printReport("primitives");
+		id = this->createInstance(bvh, mat4::identity(), NULL);
+	}
+
+	this->batching = false;
 	this->buildTopBVH();
 
 	return id;
 }
 
+BVH* Scene::buildBVH(int startIndex, int endIndex, BVHBuildMode buildMode)
+{
+	BVH* tree = new BVH(this->primitives);
+	tree->build(this->BVHs.size(), startIndex, endIndex, buildMode);
+	this->BVHs.push_back(tree);
+
+	return tree;
+}
+
+BVH* Scene::buildBVH(TriangleMesh* mesh, BVHBuildMode buildMode)
+{
+	BVH* tree = new BVH(std::vector<Primitive*>(), mesh);
+	tree->build(this->BVHs.size(), 0, mesh->count - 1, buildMode);
+	this->BVHs.push_back(tree);
+
+	return tree;
+}
+
+int Scene::createInstance(BVH* bvh, mat4 transform, Material* material)
+{
+	Instance* instance = new Instance(bvh, transform, material);
+	instance->id = this->instances.size();
+	this->instances.push_back(instance);
+
+	if (!this->batching)
+		this->buildTopBVH();
+
+	return instance->id;
+}
+
 int Scene::addPrimitive(Primitive* primitive)
 {
 	primitive->id = this->primitives.size();
 	this->primitives.push_back(primitive);
 
-	int modelId = this->buildBVH(primitive->id, primitive->id);
+	if (this->batching)
+		return -1;
 
-	this->models.push_back(
-		new Model(modelId, primitive->id, primitive->id)
-	);
+	BVH* bvh = this->buildBVH(primitive->id, primitive->id);
 
-	return modelId;
+	return this->createInstance(bvh, mat4::identity(), NULL);
+}
+
+int Scene::addInstance(int id, mat4 transform, Material* material)
+{
+	if (id < 0 || id >= this->instances.size())
+		return -1;
+
+	// instances share the primitives and the BVH of the model, which is only transformed
+	Instance* instance = this->instances[id];
+
+	return this->createInstance(instance->bvh, transform, material != NULL ? material : instance->material);
 }
 
 void Scene::addLightSource(LightSource* lightSource)
@@ -383,6 +647,7 @@ void Scene::clear()
 		delete this->primitives[i];
 	}
 	this->primitives.clear();
+	this->batchStart = 0;
 
 	for (int i = 0; i < this->lightSources.size(); i++)
 	{
@@ -392,13 +657,22 @@ void Scene::clear()
 
 	for (int i = 0; i < this->BVHs.size(); i++)
 	{
-		this->BVHs[i]->root->destroy();
-		delete this->BVHs[i]->objectIndices;
 		delete this->BVHs[i];
 	}
 	this->BVHs.clear();
 
-	this->models.clear();
+	for (int i = 0; i < this->instances.size(); i++)
+	{
+		delete this->instances[i];
+	}
+	this->instances.clear();
+
+	for (int i = 0; i < this->meshes.size(); i++)
+	{
+		delete this->meshes[i];
+	}
+	this->meshes.clear();
+	this->loadedModels.clear();
 
 	if (this->skydomeLoaded)
 	{
@@ -412,112 +686,138 @@ void Scene::clear()
 
 int Scene::getPrimitivesCount()
 {
-	return this->primitives.size();
+	int count = this->primitives.size();
+	for (int i = 0; i < this->meshes.size(); i++)
+	{
+		count += this->meshes[i]->count;
+	}
+
+	return count;
 }
 
-int Scene::loadModel(const char *filename, Material* material, vec3 translationVector)
+size_t Scene::getMemoryUsage()
 {
-	// obj file content
-	std::vector<vec3> vertices;
-	std::vector<int> faceIndexes;
-	std::vector<vec3> meshVertices;
-
-	std::ifstream stream(filename, std::ios::in);
-	if (!stream)
+	size_t bytes = this->instances.size() * (sizeof(Instance) + sizeof(BoundingBox));
+	for (int i = 0; i < this->BVHs.size(); i++)
 	{
-		printf("Cannot load %s file!", filename);
+		bytes += this->BVHs[i]->calculateMemoryUsage();
 	}
-
-	std::string line;
-	while (std::getline(stream, line))
+	for (int i = 0; i < this->meshes.size(); i++)
 	{
-		if (line.substr(0, 2) == "v ")
-		{
-			std::istringstream v(line.substr(2));
-			float x, y, z;
-			v >> x; v >> y; v >> z;
+		bytes += this->meshes[i]->calculateMemoryUsage();
+	}
+	if (this->topBVHExists) bytes += this->topBHV->calculateMemoryUsage();
 
-			vertices.push_back(vec3(x, y, z));
-		}
-		else if (line.substr(0, 2) == "vt")
-		{
-			// TODO: implement textures support
-		}
-		else if (line.substr(0, 2) == "f ")
-		{
-			std::istringstream v(line.substr(2));
-			int a, b, c;
-			v >> a; v >> b; v >> c;
+	return bytes;
+}
 
-			faceIndexes.push_back(--a);
-			faceIndexes.push_back(--b);
-			faceIndexes.push_back(--c);
-		}
+int Scene::loadModel(const char *filename, Material* material, vec3 translationVector, BVHBuildMode buildMode)
+{
+	mat4 transform = mat4::identity();
+	transform[3] = translationVector.x;
+	transform[7] = translationVector.y;
+	transform[11] = translationVector.z;
+
+	// every file is loaded once per build mode, its further models are instances of the same mesh
+	std::pair<std::string, BVHBuildMode> key(filename, buildMode);
+	std::map<std::pair<std::string, BVHBuildMode>, int>::iterator model = this->loadedModels.find(key);
+	if (model != this->loadedModels.end())
+	{
+		return this->createInstance(this->BVHs[model->second], transform, material);
 	}
 
-	// calculate mesh vertices
-	for (unsigned int i = 0; i < faceIndexes.size(); i++)
+	// the cache holds the mesh with its finished BVH as long as the file and the build settings are unchanged
+	BVH* bvh = MeshCache::enabled ? MeshCache::load(filename, material, buildMode) : NULL;
+	if (bvh != NULL)
 	{
-		meshVertices.push_back(
-			vec3(vertices[faceIndexes[i]].x, vertices[faceIndexes[i]].y, vertices[faceIndexes[i]].z) + translationVector
-		);
+		bvh->id = this->BVHs.size();
+		this->BVHs.push_back(bvh);
+		this->meshes.push_back(bvh->mesh);
 	}
-
-	// add triangles to the scene
-	int primitivesCount = meshVertices.size() / 3;
-	int startIndex = this->primitives.size();
-	for (int i = 0; i < primitivesCount; i++)
+	else
 	{
-		vec3 a = meshVertices[i * 3];
-		vec3 b = meshVertices[i * 3 + 1];
-		vec3 c = meshVertices[i * 3 + 2];
+		std::vector<float> vertices;
+		std::vector<int> indices;
+		if (!ObjLoader::load(filename, vertices, indices))
+		{
+			return -1;
+		}
 
-		Triangle* triangle = new Triangle(material, a, b, c);
-		triangle->id = this->primitives.size();
-		this->primitives.push_back(triangle);
-	}
-	int endIndex = this->primitives.size() - 1;
+		// triangles are stored in the mesh, not as primitives of the scene
+		TriangleMesh* triangleMesh = new TriangleMesh(material, vertices, indices);
+		this->meshes.push_back(triangleMesh);
+
+		bvh = this->buildBVH(triangleMesh, buildMode);
+		bvh->printReport(filename);
 
-	int modelId = this->buildBVH(startIndex, endIndex);
-	this->models.push_back(
-		new Model(modelId, startIndex, endIndex)
-	);
+		if (MeshCache::enabled) MeshCache::save(filename, bvh);
+	}
+	this->loadedModels[key] = bvh->id;
 
-	return modelId;
+	return this->createInstance(bvh, transform, material);
 }
 
 void Scene::translateModel(int id, vec3 vector)
 {
-	// find model by id
-	Model* model;
-	for (int i = 0; i < this->models.size(); i++)
-	{
-		if (this->models[i]->id == id) model = this->models[i];
-	}
+	if (id < 0 || id >= this->instances.size())
+		return;
 
-	// find BVH by id
-	BVH* bvh;
-	for (int i = 0; i < this->BVHs.size(); i++)
-	{
-		if (this->BVHs[i]->id == id) bvh = this->BVHs[i];
-	}
+	// only the instance moves, its mesh and BVH are shared with the other instances
+	this->instances[id]->translate(vector);
 
-	if (model == NULL || bvh == NULL) return;
+	this->refitTopBVH();
+}
 
-	// translate model
-	for (int i = model->startIndex; i <= model->endIndex; i++)
-	{
-		this->primitives[i]->translate(vector);
-	}
+void Scene::rebuildModel(int id)
+{
+	if (id < 0 || id >= this->instances.size())
+		return;
 
-	// translate bvh
-	bvh->root->translate(vector);
+	// deformed meshes are rebuilt with their own build mode, use mortonCodes for meshes rebuilt every frame.
+	// All instances of the mesh are affected.
+	this->instances[id]->bvh->rebuild();
 
-	this->buildTopBVH();
+	this->refitTopBVH();
 }
 
 void Scene::loadSkydome(const char* fileName)
 {
 	this->skydome = new HDRBitmap(fileName);
 	this->skydomeLoaded = true;
+
+	// the headless reader leaves the bitmap empty when the file can not be read, the background color is used instead
+	if (!this->skydome->buffer)
+	{
+		delete this->skydome;
+		this->skydomeLoaded = false;
+	}
+}
+
+vec4 Scene::getAccumulatedColor(int x, int y)
+{
+	return this->accumulator[y * SCRWIDTH + x] * this->inversedAccumulatorCounter;
+}
+
+Scene::RayCounters Scene::getRayCounters()
+{
+	RayCounters rayCounters = { this->primaryRays, this->secondaryRays, this->shadowRays };
+	return rayCounters;
+}
+
+void Scene::resetRayCounters()
+{
+	this->primaryRays = 0;
+	this->secondaryRays = 0;
+	this->shadowRays = 0;
+}
+
+float Scene::getBVHBuildTime()
+{
+	float buildTime = this->topBVHBuildTime;
+	for (int i = 0; i < this->BVHs.size(); i++)
+	{
+		buildTime += this->BVHs[i]->buildTime;
+	}
+
+	return buildTime;
 }
\ No newline at end of file
@@ -6,19 +6,39 @@ namespace Tmpl8 {
 		Scene(Surface* screen);
 		Camera* camera;
 
-		void render(int row);
+		void render(int left, int top, int width, int height); // renders one rectangle of pixels, tiles may render concurrently
 		void increaseAccumulator();
 		void resetAccumulator();
+		void setSampler(SamplerType samplerType);
+
+		// primitives added during a batch share one BVH, so its leaves mix primitives of all types. commitBatch builds
+		// it with its instance and returns the instance id, addPrimitive returns -1 for batched primitives.
+		void beginBatch();
+		int commitBatch();
 
 		int addPrimitive(Primitive* primitive);
+		int addInstance(int id, mat4 transform, Material* material = NULL);
 		void addLightSource(LightSource* lightSource);
 
-		int loadModel(const char *filename, Material* material, vec3 translationVector = vec3(0));
+		int loadModel(const char *filename, Material* material, vec3 translationVector = vec3(0), BVHBuildMode buildMode = binnedSAH);
 		void translateModel(int id, vec3 vector);
+		void rebuildModel(int id);
 
 		void loadSkydome(const char* fileName);
 
+		vec4 getAccumulatedColor(int x, int y); // linear average of all samples of the pixel so far
+
+		// rays traced since the last reset, summed over all threads
+		struct RayCounters
+		{
+			long long primary, secondary, shadow;
+		};
+		RayCounters getRayCounters();
+		void resetRayCounters();
+		float getBVHBuildTime(); // milliseconds spent on the bottom level BVHs and the last top level BVH
+
 		int getPrimitivesCount();
+		size_t getMemoryUsage(); // bytes allocated by the BVHs, meshes and instances, shared BVHs are counted once
 		void clear();
 	private:
 		Surface* screen;
@@ -26,11 +46,16 @@ namespace Tmpl8 {
 		vec4 accumulator[SCRHEIGHT * SCRWIDTH];
 		int accumulatorCounter;
 		float inversedAccumulatorCounter;
-		std::mt19937 randomNumbersGenerator;
+		SamplerType samplerType;
 
 		TopBVH* topBHV;
 		std::vector<BVH*> BVHs;
+		std::vector<Instance*> instances;
+		std::vector<TriangleMesh*> meshes;
+		std::map<std::pair<std::string, BVHBuildMode>, int> loadedModels; // BVH of every loaded model file and build mode
 		bool topBVHExists;
+		bool batching; // top level is built once on commit instead of after every added model
+		int batchStart; // first primitive added during the batch
 
 		std::vector<Primitive*> primitives;
 		std::vector<LightSource*> lightSources;
@@ -38,31 +63,55 @@ namespace Tmpl8 {
 		HDRBitmap* skydome;
 		bool skydomeLoaded;
 
-		struct Model
+		// tiles count their rays locally and add them once they are done
+		std::atomic<long long> primaryRays, secondaryRays, shadowRays;
+		float topBVHBuildTime;
+
+		// shadow ray of next event estimation, its contribution already includes the throughput of the path
+		struct ShadowRay
 		{
-			Model::Model(int id, int startIndex, int endIndex)
-			{
-				this->id = id;
-				this->startIndex = startIndex;
-				this->endIndex = endIndex;
-			}
-			int id, startIndex, endIndex;
+			vec3 origin, direction;
+			float distance; // 0 when no shadow ray is needed
+			vec4 contribution;
 		};
-		std::vector<Model*> models;
 
-		vec4 sample(Ray* ray, bool isLastPrimitiveSpecular = false);
+		// path state of renderWavefront in one array per field. Every worker thread keeps its own between tiles
+		// and frames, the buffers only grow when a larger tile comes along.
+		struct WavefrontBuffers
+		{
+			std::vector<Ray> rays;
+			std::vector<vec4> colors, throughputs;
+			std::vector<char> specular;
+			std::vector<ShadowRay> shadowRays;
+			std::vector<Sampler> samplers;
+			std::vector<int> activePaths;
+
+			void reserve(int pathsCount);
+		};
+
+		void renderWavefront(int left, int top, int width, int height);
+		Ray* generateRay(int x, int row, int stratum, Sampler& sampler);
+		vec4 sample(Ray* ray, Sampler& sampler, RayCounters& rayCounters);
+		bool extendPath(Ray* ray, vec4& color, vec4& throughput, bool& specular, ShadowRay& shadowRay, Sampler& sampler);
 		vec4 sampleSkydome(Ray* ray);
-		vec4 illuminate(Ray* ray);
-		Ray* computeDiffuseReflectionRay(Ray* ray);
-		Ray* computeReflectionRay(Ray* ray);
-		Ray* computeRefractionRay(Ray* ray);
+		void sampleLight(vec3 hitPoint, vec3 primitiveNormal, vec4 BRDF, ShadowRay& shadowRay, Sampler& sampler);
+		Ray computeDiffuseReflectionRay(Ray* ray, Sampler& sampler);
+		Ray computeReflectionRay(Ray* ray);
+		Ray computeRefractionRay(Ray* ray);
 		float calculateRefractionProbability(Ray* ray);
-		void intersectPrimitives(Ray* ray, bool isShadowRay = false);
+		void intersectPrimitives(Ray* ray);
+		bool occluded(vec3 origin, vec3 direction, float tmax);
 		void intersectLightSources(Ray* ray);
 
 		Pixel convertColorToPixel(vec4 color);
 
+		Material* getIntersectedMaterial(Ray* ray);
+		vec3 getIntersectedNormal(Ray* ray, vec3 hitPoint);
+
 		void buildTopBVH();
-		int buildBVH(int startIndex, int endIndex);
+		void refitTopBVH();
+		BVH* buildBVH(int startIndex, int endIndex, BVHBuildMode buildMode = binnedSAH);
+		BVH* buildBVH(TriangleMesh* mesh, BVHBuildMode buildMode);
+		int createInstance(BVH* bvh, mat4 transform, Material* material);
 	};
 }
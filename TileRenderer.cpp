@@ -0,0 +1,87 @@
+#include "precomp.h"
+
+#define TILE_SIZE 16 // pixels, tiles at the right and bottom edges may be smaller
+
+void RenderTileJob::Main()
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	this->scene->render(this->left, this->top, this->width, this->height);
+	this->renderTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// spreads the lower 16 bits of a value to the even bits
+static unsigned int expandBits(unsigned int value)
+{
+	value &= 0xffff;
+	value = (value | (value << 8)) & 0x00ff00ff;
+	value = (value | (value << 4)) & 0x0f0f0f0f;
+	value = (value | (value << 2)) & 0x33333333;
+	value = (value | (value << 1)) & 0x55555555;
+	return value;
+}
+
+TileRenderer::TileRenderer(Scene* scene)
+{
+	int columns = (SCRWIDTH + TILE_SIZE - 1) / TILE_SIZE;
+	int rows = (SCRHEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+
+	// the tile grid is not a power of two, so the tiles are sorted by their codes instead of decoding them
+	std::vector<std::pair<unsigned int, int>> codes;
+	for (int i = 0; i < columns * rows; i++)
+	{
+		int column = i % columns, row = i / columns;
+		codes.push_back(std::make_pair(expandBits(column) | (expandBits(row) << 1), i));
+	}
+	std::sort(codes.begin(), codes.end());
+
+	this->tiles.resize(codes.size());
+	for (int i = 0; i < codes.size(); i++)
+	{
+		int column = codes[i].second % columns, row = codes[i].second / columns;
+
+		RenderTileJob& tile = this->tiles[i];
+		tile.scene = scene;
+		tile.left = column * TILE_SIZE;
+		tile.top = row * TILE_SIZE;
+		tile.width = MIN(TILE_SIZE, SCRWIDTH - tile.left);
+		tile.height = MIN(TILE_SIZE, SCRHEIGHT - tile.top);
+		tile.renderTime = 0;
+	}
+
+	this->frameTime = this->slowestTile = this->tailTime = 0;
+	this->steals = 0;
+}
+
+void TileRenderer::render()
+{
+	JobManager* jobManager = JobManager::GetJobManager();
+	if (MULTITHREADING_ENABLED && jobManager)
+	{
+		for (int i = 0; i < this->tiles.size(); i++)
+		{
+			jobManager->AddJob2(&this->tiles[i]);
+		}
+		jobManager->RunJobs();
+
+		this->frameTime = jobManager->GetBatchTime();
+		this->tailTime = jobManager->GetTailTime();
+		this->steals = jobManager->GetStealCount();
+	}
+	else
+	{
+		this->frameTime = 0;
+		for (int i = 0; i < this->tiles.size(); i++)
+		{
+			this->tiles[i].Main();
+			this->frameTime += this->tiles[i].renderTime;
+		}
+		this->tailTime = 0;
+		this->steals = 0;
+	}
+
+	this->slowestTile = 0;
+	for (int i = 0; i < this->tiles.size(); i++)
+	{
+		this->slowestTile = MAX(this->slowestTile, this->tiles[i].renderTime);
+	}
+}
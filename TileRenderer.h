@@ -0,0 +1,31 @@
+#pragma once
+namespace Tmpl8
+{
+	// renders one tile of the screen and measures how long it took
+	class RenderTileJob : public Job
+	{
+	public:
+		void Main();
+
+		Scene* scene;
+		int left, top, width, height;
+		float renderTime; // milliseconds of the last frame
+	};
+
+	// renders frames as small square tiles on the job manager. Tiles are queued in Morton order, so the
+	// contiguous share of every worker is a compact region of the screen and stolen tiles are far from it.
+	class TileRenderer
+	{
+	public:
+		TileRenderer(Scene* scene);
+
+		std::vector<RenderTileJob> tiles; // in Morton order
+
+		// statistics of the last frame in milliseconds, the tail is the time from the first worker
+		// running out of tiles until the frame is done
+		float frameTime, slowestTile, tailTime;
+		int steals;
+
+		void render();
+	};
+}
@@ -1,143 +1,514 @@
 #include "precomp.h"
 
 #define BINS_COUNT 4
+#define MAX_DEPTH 20
+#define STACK_SIZE 64
+#define WIDE_STACK_SIZE 256
+#define REBUILD_THRESHOLD 1.3f // refitted trees are rebuilt once their SAH cost grew by this factor
 
-TopBVH::TopBVH(std::vector<Primitive*> primitives, std::vector<BVH*> BVHs) : BVH(primitives)
+TopBVH::TopBVH(std::vector<Primitive*> primitives, std::vector<Instance*> instances) : BVH(primitives)
 {
-	this->BVHs = BVHs;
+	this->instances = instances;
 
-	// build primitive and BVH indices array
-	this->primitiveIndices = new int[this->primitives.size()];
-	this->objectIndices = new int[BVHs.size()];
-
-	int count = 0;
-	for (int i = 0; i < this->BVHs.size(); i++)
+	// leaves reference instances by their index, bounds are owned by the instances
+	this->objectIndicesCount = instances.size();
+	this->objectIndices = new int[instances.size()];
+	for (int i = 0; i < this->instances.size(); i++)
 	{
-		for (int j = this->BVHs[i]->root->first; j < this->BVHs[i]->root->first + this->BVHs[i]->root->count; j++)
-		{
-			this->primitiveIndices[count] = this->BVHs[i]->objectIndices[j];
-			count++;
-		}
+		this->objectIndices[i] = i;
+		this->boundingBoxes.push_back(instances[i]->boundingBox);
+	}
+
+	// create root
+	this->allocateNodes(this->instances.size());
 
-		// create BVH indices array
-		this->objectIndices[i] = BVHs[i]->id;
+	BVHNode* root = &this->nodes[0];
+	root->leftFirst = 0;
+	root->count = this->instances.size();
 
+	this->calculateBounds(root);
+	this->subdivide(root, 0);
+
+	this->SAHCost = this->calculateSAHCost();
+}
+
+void TopBVH::subdivide(BVHNode* node, int depth)
+{
+	// leaves reference exactly one bottom level BVH
+	if (node->count == 1)
+	{
+		return;
 	}
 
-	// fill bounding boxes vector
-	for (int i = 0; i < this->BVHs.size(); i++)
+	BVHNode left, right;
+	if (depth >= MAX_DEPTH || !this->partition(node, &left, &right, BINS_COUNT))
 	{
-		this->boundingBoxes.push_back(this->BVHs[i]->root->boundingBox);
+		// degenerate tree or no useful split, split instances in half to keep the traversal stack bounded
+		left.leftFirst = node->leftFirst;
+		left.count = node->count / 2;
+		this->calculateBounds(&left);
+
+		right.leftFirst = node->leftFirst + left.count;
+		right.count = node->count - left.count;
+		this->calculateBounds(&right);
 	}
+	node->count = 0;
 
-	// create root
-	this->root = new BVHNode();
-	this->root->first = 0;
-	this->root->count = this->BVHs.size();
+	depth++;
 
-	this->nodes.push_back(this->root);
+	BVHNode* leftNode = &this->nodes[this->nodesUsed++];
+	*leftNode = left;
+	this->subdivide(leftNode, depth);
 
-	this->calculateBounds(this->root);
-	this->subdivide(this->root);
+	node->leftFirst = this->nodesUsed;
+	BVHNode* rightNode = &this->nodes[this->nodesUsed++];
+	*rightNode = right;
+	this->subdivide(rightNode, depth);
 }
 
-void TopBVH::subdivide(BVHNode* node)
+bool TopBVH::refit()
 {
-	if (node->count == 1)
+	if (this->instances.empty())
+		return true;
+
+	for (int i = 0; i < this->instances.size(); i++)
 	{
-		int index = this->objectIndices[node->first];
+		this->instances[i]->calculateBounds();
+	}
 
-		node->first = this->BVHs[index]->root->first;
-		node->count = this->BVHs[index]->root->count;
+	// children are stored after their parents, a reverse sweep updates the nodes bottom-up
+	for (int i = this->nodesUsed - 1; i >= 0; i--)
+	{
+		BVHNode* node = &this->nodes[i];
+		if (node->isLeaf())
+		{
+			this->calculateBounds(node);
+		}
+		else
+		{
+			node->setBounds(node + 1, &this->nodes[node->leftFirst]);
+		}
+	}
 
-		node->left = this->BVHs[index]->root->left;
-		node->right = this->BVHs[index]->root->right;
+	// the topology is kept, it degrades as instances move away from their neighbours
+	return this->calculateSAHCost() <= REBUILD_THRESHOLD * this->SAHCost;
+}
 
-		node->isLeaf = this->BVHs[index]->root->isLeaf;
+void TopBVH::traverse(Ray* ray)
+{
+	if (this->instances.empty())
+		return;
 
+	BVHNode* node = &this->nodes[0];
+	float entryDistance;
+	if (!node->intersects(ray, entryDistance))
 		return;
+
+	StackEntry stack[STACK_SIZE];
+	int stackPointer = 0;
+
+	while (true)
+	{
+		if (node->isLeaf())
+		{
+			this->traverseInstance(this->instances[this->objectIndices[node->leftFirst]], ray);
+		}
+		else
+		{
+			BVHNode* nearChild = node + 1;
+			BVHNode* farChild = &this->nodes[node->leftFirst];
+
+			float nearDistance, farDistance;
+			bool nearHit = nearChild->intersects(ray, nearDistance);
+			bool farHit = farChild->intersects(ray, farDistance);
+
+			if (nearHit && farHit)
+			{
+				if (farDistance < nearDistance)
+				{
+					swap(nearChild, farChild);
+					swap(nearDistance, farDistance);
+				}
+
+				stack[stackPointer].node = farChild;
+				stack[stackPointer].entryDistance = farDistance;
+				stackPointer++;
+
+				node = nearChild;
+				continue;
+			}
+			if (nearHit || farHit)
+			{
+				node = nearHit ? nearChild : farChild;
+				continue;
+			}
+		}
+
+		// pop the next node, skipping the ones behind the closest intersection found so far
+		do
+		{
+			if (stackPointer == 0)
+				return;
+
+			stackPointer--;
+		} while (stack[stackPointer].entryDistance > ray->t);
+
+		node = stack[stackPointer].node;
+	}
+}
+
+void TopBVH::traverseInstance(Instance* instance, Ray* ray)
+{
+	// bottom levels are traversed in object space
+	Ray objectRay;
+	Ray* bottomLevelRay = ray;
+	float scale = 1;
+	if (!instance->identity)
+	{
+		scale = instance->createObjectRay(ray, objectRay);
+		bottomLevelRay = &objectRay;
+	}
+
+	// bottom level root is covered by this leaf, traversals continue there without testing it again
+	float t = bottomLevelRay->t;
+	BVH* bvh = instance->bvh;
+	if (BVH_WIDTH == 4) this->traverseBottomLevel(bvh->bvh4, bvh, bottomLevelRay);
+	else if (BVH_WIDTH == 8) this->traverseBottomLevel(bvh->bvh8, bvh, bottomLevelRay);
+	else this->traverseBottomLevel(bvh, bottomLevelRay);
+
+	if (bottomLevelRay->t < t)
+	{
+		ray->t = bottomLevelRay->t / scale;
+		ray->intersectedObjectId = bottomLevelRay->intersectedObjectId;
+		ray->instanceId = instance->id;
 	}
+}
 
-	node->left = new BVHNode();
-	node->right = new BVHNode();
-	
-	this->nodes.push_back(node->left);
-	this->nodes.push_back(node->right);
+bool TopBVH::occludedInstance(Instance* instance, Ray* ray)
+{
+	Ray objectRay;
+	Ray* bottomLevelRay = ray;
+	if (!instance->identity)
+	{
+		instance->createObjectRay(ray, objectRay);
+		bottomLevelRay = &objectRay;
+	}
 
-	this->partition(node, BINS_COUNT);
+	BVH* bvh = instance->bvh;
+	if (BVH_WIDTH == 4) return this->occludedBottomLevel(bvh->bvh4, bvh, bottomLevelRay);
+	if (BVH_WIDTH == 8) return this->occludedBottomLevel(bvh->bvh8, bvh, bottomLevelRay);
 
-	this->subdivide(node->left);
-	this->subdivide(node->right);
+	return this->occludedBottomLevel(bvh, bottomLevelRay);
 }
 
-void TopBVH::traverse(BVHNode* node, Ray* ray, bool isShadowRay)
+void TopBVH::intersectObjects(BVH* bvh, int first, int count, Ray* ray)
 {
-	if (!node->intersects(ray))
+	if (bvh->packets4 != NULL)
+	{
+		this->intersectPackets(&bvh->packets4[bvh->packetIndices[first]], count, ray);
+		return;
+	}
+	if (bvh->packets8 != NULL)
+	{
+		this->intersectPackets(&bvh->packets8[bvh->packetIndices[first]], count, ray);
 		return;
+	}
+	if (bvh->mesh != NULL)
+	{
+		for (int i = first; i < first + count; i++)
+		{
+			bvh->mesh->intersect(bvh->objectIndices[i], ray);
+		}
 
-	if (isShadowRay && ray->intersectedObjectId != -1)
 		return;
+	}
 
-	if (node->isLeaf)
+	for (int i = first; i < first + count; i++)
 	{
-		// intersect primitves
-		for (int i = node->first; i < node->first + node->count; i++)
+		bvh->primitiveArrays->intersect(bvh->primitiveReferences[i], ray);
+	}
+}
+
+bool TopBVH::occludedObjects(BVH* bvh, int first, int count, Ray* ray)
+{
+	if (bvh->packets4 != NULL)
+		return this->occludedPackets(&bvh->packets4[bvh->packetIndices[first]], count, ray);
+	if (bvh->packets8 != NULL)
+		return this->occludedPackets(&bvh->packets8[bvh->packetIndices[first]], count, ray);
+	if (bvh->mesh != NULL)
+	{
+		for (int i = first; i < first + count; i++)
 		{
-			int index = this->primitiveIndices[i];
-			this->primitives[index]->intersect(ray);
+			if (bvh->mesh->occludes(bvh->objectIndices[i], ray))
+				return true;
+		}
 
-			if (isShadowRay && ray->intersectedObjectId != -1)
-				return;
+		return false;
+	}
+
+	for (int i = first; i < first + count; i++)
+	{
+		if (bvh->primitiveArrays->occludes(bvh->primitiveReferences[i], ray))
+			return true;
+	}
+
+	return false;
+}
+
+template <class Packet>
+void TopBVH::intersectPackets(Packet* packets, int count, Ray* ray)
+{
+	// count is the number of triangles of the leaf, the last packet may be partially filled
+	for (int i = 0; i < count; i += Packet::WIDTH, packets++)
+	{
+		float t;
+		int lane = packets->intersect(ray, t);
+		if (lane != -1)
+		{
+			ray->t = t;
+			ray->intersectedObjectId = packets->index[lane];
 		}
 	}
-	else
+}
+
+template <class Packet>
+bool TopBVH::occludedPackets(Packet* packets, int count, Ray* ray)
+{
+	for (int i = 0; i < count; i += Packet::WIDTH, packets++)
+	{
+		if (packets->occludes(ray))
+			return true;
+	}
+
+	return false;
+}
+
+void TopBVH::traverseBottomLevel(BVH* bvh, Ray* ray)
+{
+	BVHNode* node = &bvh->nodes[0];
+
+	StackEntry stack[STACK_SIZE];
+	int stackPointer = 0;
+
+	while (true)
 	{
-		if (!isShadowRay)
+		if (node->isLeaf())
+		{
+			this->intersectObjects(bvh, node->leftFirst, node->count, ray);
+		}
+		else
+		{
+			BVHNode* nearChild = node + 1;
+			BVHNode* farChild = &bvh->nodes[node->leftFirst];
+
+			float nearDistance, farDistance;
+			bool nearHit = nearChild->intersects(ray, nearDistance);
+			bool farHit = farChild->intersects(ray, farDistance);
+
+			if (nearHit && farHit)
+			{
+				if (farDistance < nearDistance)
+				{
+					swap(nearChild, farChild);
+					swap(nearDistance, farDistance);
+				}
+
+				stack[stackPointer].node = farChild;
+				stack[stackPointer].entryDistance = farDistance;
+				stackPointer++;
+
+				node = nearChild;
+				continue;
+			}
+			if (nearHit || farHit)
+			{
+				node = nearHit ? nearChild : farChild;
+				continue;
+			}
+		}
+
+		// pop the next node, skipping the ones behind the closest intersection found so far
+		do
 		{
-			float dxLeft = MAX(MAX(node->left->boundingBox->min.x - ray->origin.x, 0), ray->origin.x - node->left->boundingBox->max.x);
-			float dyLeft = MAX(MAX(node->left->boundingBox->min.y - ray->origin.y, 0), ray->origin.y - node->left->boundingBox->max.y);
-			float dzLeft = MAX(MAX(node->left->boundingBox->min.z - ray->origin.z, 0), ray->origin.z - node->left->boundingBox->max.z);
+			if (stackPointer == 0)
+				return;
+
+			stackPointer--;
+		} while (stack[stackPointer].entryDistance > ray->t);
+
+		node = stack[stackPointer].node;
+	}
+}
+
+template <class WideNode>
+void TopBVH::traverseBottomLevel(MBVH<WideNode>* wideBVH, BVH* bvh, Ray* ray)
+{
+	WideRay wideRay(ray);
+	WideNode* node = &wideBVH->nodes[0];
+	float entryDistances[WideNode::WIDTH];
+
+	WideStackEntry stack[WIDE_STACK_SIZE];
+	int stackPointer = 0;
 
-			float dxRight = MAX(MAX(node->right->boundingBox->min.x - ray->origin.x, 0), ray->origin.x - node->right->boundingBox->max.x);
-			float dyRight = MAX(MAX(node->right->boundingBox->min.y - ray->origin.y, 0), ray->origin.y - node->right->boundingBox->max.y);
-			float dzRight = MAX(MAX(node->right->boundingBox->min.z - ray->origin.z, 0), ray->origin.z - node->right->boundingBox->max.z);
+	while (true)
+	{
+		// push intersected children sorted from far to near, so the nearest one is popped first
+		int hitMask = node->intersect(wideRay, ray->t, entryDistances);
+		int firstPushed = stackPointer;
 
-			float distanceLeft = vec3(dxLeft, dyLeft, dzLeft).sqrLentgh();
-			float distanceRight = vec3(dxRight, dyRight, dzRight).sqrLentgh();
+		for (int i = 0; i < WideNode::WIDTH; i++)
+		{
+			if (!(hitMask & (1 << i))) continue;
 
-			if (distanceLeft < distanceRight)
+			int j = stackPointer++;
+			while (j > firstPushed && stack[j - 1].entryDistance < entryDistances[i])
 			{
-				this->traverse(node->left, ray, isShadowRay);
-				//printf("DistanceLeft: %f, DistanceRight: %f, ray->t: %f \n", distanceLeft, distanceRight, ray->t);
-				if (ray->t * ray->t > distanceRight)
-					this->traverse(node->right, ray, isShadowRay);
+				stack[j] = stack[j - 1];
+				j--;
 			}
-			else
+
+			stack[j].child = node->child[i];
+			stack[j].count = node->count[i];
+			stack[j].entryDistance = entryDistances[i];
+		}
+
+		// pop the next interior node, intersecting leaves on the way
+		while (true)
+		{
+			if (stackPointer == 0)
+				return;
+
+			WideStackEntry entry = stack[--stackPointer];
+			if (entry.entryDistance > ray->t)
+				continue;
+
+			if (entry.count == 0)
 			{
-				this->traverse(node->right, ray, isShadowRay);
-				//printf("DistanceLeft: %f, DistanceRight: %f, ray->t: %f \n", distanceLeft, distanceRight, ray->t);
-				if (ray->t * ray->t > distanceLeft)
-					this->traverse(node->left, ray, isShadowRay);
+				node = &wideBVH->nodes[entry.child];
+				break;
 			}
+
+			this->intersectObjects(bvh, entry.child, entry.count, ray);
+		}
+	}
+}
+
+bool TopBVH::occluded(Ray* ray)
+{
+	if (this->instances.empty())
+		return false;
+
+	BVHNode* node = &this->nodes[0];
+	float entryDistance;
+	if (!node->intersects(ray, entryDistance))
+		return false;
+
+	BVHNode* stack[STACK_SIZE];
+	int stackPointer = 0;
+
+	while (true)
+	{
+		if (node->isLeaf())
+		{
+			if (this->occludedInstance(this->instances[this->objectIndices[node->leftFirst]], ray))
+				return true;
 		}
 		else
 		{
-			this->traverse(node->left, ray, isShadowRay);
-			this->traverse(node->right, ray, isShadowRay);
+			// any hit will do, children are visited in memory order
+			BVHNode* left = node + 1;
+			BVHNode* right = &this->nodes[node->leftFirst];
+
+			bool leftHit = left->intersects(ray, entryDistance);
+			bool rightHit = right->intersects(ray, entryDistance);
+
+			if (leftHit && rightHit) stack[stackPointer++] = right;
+			if (leftHit || rightHit)
+			{
+				node = leftHit ? left : right;
+				continue;
+			}
 		}
-		//this->traverse(node->left, ray, isShadowRay);
-		//this->traverse(node->right, ray, isShadowRay);
+
+		if (stackPointer == 0)
+			return false;
+
+		node = stack[--stackPointer];
 	}
 }
 
-TopBVH::~TopBVH()
+bool TopBVH::occludedBottomLevel(BVH* bvh, Ray* ray)
 {
-	for (int i = 0; i < this->nodes.size(); i++)
+	BVHNode* node = &bvh->nodes[0];
+
+	BVHNode* stack[STACK_SIZE];
+	int stackPointer = 0;
+
+	while (true)
 	{
-		delete this->nodes[i]->boundingBox;
-		delete this->nodes[i];
+		if (node->isLeaf())
+		{
+			if (this->occludedObjects(bvh, node->leftFirst, node->count, ray))
+				return true;
+		}
+		else
+		{
+			BVHNode* left = node + 1;
+			BVHNode* right = &bvh->nodes[node->leftFirst];
+
+			float entryDistance;
+			bool leftHit = left->intersects(ray, entryDistance);
+			bool rightHit = right->intersects(ray, entryDistance);
+
+			if (leftHit && rightHit) stack[stackPointer++] = right;
+			if (leftHit || rightHit)
+			{
+				node = leftHit ? left : right;
+				continue;
+			}
+		}
+
+		if (stackPointer == 0)
+			return false;
+
+		node = stack[--stackPointer];
 	}
+}
+
+template <class WideNode>
+bool TopBVH::occludedBottomLevel(MBVH<WideNode>* wideBVH, BVH* bvh, Ray* ray)
+{
+	WideRay wideRay(ray);
+	WideNode* node = &wideBVH->nodes[0];
+	float entryDistances[WideNode::WIDTH];
+
+	WideStackEntry stack[WIDE_STACK_SIZE];
+	int stackPointer = 0;
+
+	while (true)
+	{
+		int hitMask = node->intersect(wideRay, ray->t, entryDistances);
+
+		for (int i = 0; i < WideNode::WIDTH; i++)
+		{
+			if (!(hitMask & (1 << i))) continue;
 
-	delete this->primitiveIndices;
-	delete this->objectIndices;
+			// leaves are tested right away, any hit will do
+			if (node->count[i] > 0)
+			{
+				if (this->occludedObjects(bvh, node->child[i], node->count[i], ray))
+					return true;
+
+				continue;
+			}
+
+			stack[stackPointer].child = node->child[i];
+			stackPointer++;
+		}
+
+		if (stackPointer == 0)
+			return false;
+
+		node = &wideBVH->nodes[stack[--stackPointer].child];
+	}
 }
\ No newline at end of file
@@ -4,20 +4,41 @@ namespace Tmpl8
 	class TopBVH : public BVH
 	{
 	public:
-		TopBVH(std::vector<Primitive*> primitives, std::vector<BVH*> BVHs);
-		~TopBVH();
+		TopBVH(std::vector<Primitive*> primitives, std::vector<Instance*> instances);
 
-		BVHNode* root;
-
-		void traverse(BVHNode* node, Ray* ray, bool isShadowRay);
+		void traverse(Ray* ray);
+		bool occluded(Ray* ray);
+		bool refit();
 
 	protected:
-		void subdivide(BVHNode* node);
+		void subdivide(BVHNode* node, int depth);
 
 	private:
-		int* primitiveIndices;
-		std::vector<BVH*> BVHs;
-		std::vector<BVHNode*> nodes;
+		struct StackEntry
+		{
+			BVHNode* node;
+			float entryDistance;
+		};
+
+		struct WideStackEntry
+		{
+			int child, count;
+			float entryDistance;
+		};
+
+		std::vector<Instance*> instances;
+
+		void traverseInstance(Instance* instance, Ray* ray);
+		bool occludedInstance(Instance* instance, Ray* ray);
+		void intersectObjects(BVH* bvh, int first, int count, Ray* ray);
+		bool occludedObjects(BVH* bvh, int first, int count, Ray* ray);
+		template <class Packet> void intersectPackets(Packet* packets, int count, Ray* ray);
+		template <class Packet> bool occludedPackets(Packet* packets, int count, Ray* ray);
+
+		void traverseBottomLevel(BVH* bvh, Ray* ray);
+		bool occludedBottomLevel(BVH* bvh, Ray* ray);
+
+		template <class WideNode> void traverseBottomLevel(MBVH<WideNode>* wideBVH, BVH* bvh, Ray* ray);
+		template <class WideNode> bool occludedBottomLevel(MBVH<WideNode>* wideBVH, BVH* bvh, Ray* ray);
 	};
 }
-
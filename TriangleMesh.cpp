@@ -0,0 +1,162 @@
+#include "precomp.h"
+
+TriangleMesh::TriangleMesh(Material* material, std::vector<float>& vertices, std::vector<int>& indices)
+{
+	this->material = material;
+	this->count = indices.size() / 3;
+	this->vertices.swap(vertices);
+	this->indices.swap(indices);
+	this->allocateArrays();
+
+	for (int i = 0; i < this->count; i++)
+	{
+		vec3 a, b, c;
+		this->getVertices(i, a, b, c);
+
+		vec3 normal = normalize(cross(a - b, b - c));
+		this->normalX[i] = normal.x; this->normalY[i] = normal.y; this->normalZ[i] = normal.z;
+
+		if (this->packed) continue;
+
+		vec3 edge1 = b - a;
+		vec3 edge2 = c - a;
+		this->x[i] = a.x; this->y[i] = a.y; this->z[i] = a.z;
+		this->edge1X[i] = edge1.x; this->edge1Y[i] = edge1.y; this->edge1Z[i] = edge1.z;
+		this->edge2X[i] = edge2.x; this->edge2Y[i] = edge2.y; this->edge2Z[i] = edge2.z;
+	}
+}
+
+TriangleMesh::TriangleMesh(Material* material, int count)
+{
+	this->material = material;
+	this->count = count;
+	this->allocateArrays();
+}
+
+TriangleMesh::~TriangleMesh()
+{
+	FREE64(this->normalX);
+}
+
+int TriangleMesh::getArraysCount()
+{
+	return this->packed ? 3 : 12;
+}
+
+size_t TriangleMesh::calculateMemoryUsage()
+{
+	size_t arraysSize = MAX(this->getArraysCount() * this->stride, 16) * sizeof(float);
+	return this->vertices.capacity() * sizeof(float) + this->indices.capacity() * sizeof(int) + arraysSize;
+}
+
+void TriangleMesh::allocateArrays()
+{
+	// one allocation for all arrays, packed meshes leave the positions and edges to the packets
+	this->packed = TRIANGLE_PACKET_WIDTH > 1;
+	this->stride = (this->count + 15) & ~15;
+	float* data = (float*)MALLOC64(MAX(this->getArraysCount() * this->stride, 16) * sizeof(float));
+	float** arrays[12] = {
+		&this->normalX, &this->normalY, &this->normalZ,
+		&this->x, &this->y, &this->z,
+		&this->edge1X, &this->edge1Y, &this->edge1Z,
+		&this->edge2X, &this->edge2Y, &this->edge2Z
+	};
+	for (int i = 0; i < 12; i++)
+	{
+		*arrays[i] = i < this->getArraysCount() ? data + i * this->stride : NULL;
+	}
+}
+
+void TriangleMesh::intersect(int index, Ray* ray)
+{
+	vec3 a, ab, ac;
+	this->getEdges(index, a, ab, ac);
+	vec3 pvec = ray->direction.cross(ac);
+	float invDet = 1 / ab.dot(pvec);
+
+	vec3 tvec = ray->origin - a;
+	float u = tvec.dot(pvec) * invDet;
+	if (u < 0 || u > 1) return;
+
+	vec3 qvec = tvec.cross(ab);
+	float v = ray->direction.dot(qvec) * invDet;
+	if (v < 0 || u + v > 1) return;
+
+	float t = ac.dot(qvec) * invDet;
+	if (t < ray->t && t >= EPSILON)
+	{
+		ray->t = t;
+		ray->intersectedObjectId = index;
+	}
+}
+
+bool TriangleMesh::occludes(int index, Ray* ray)
+{
+	vec3 a, ab, ac;
+	this->getEdges(index, a, ab, ac);
+	vec3 pvec = ray->direction.cross(ac);
+	float invDet = 1 / ab.dot(pvec);
+
+	vec3 tvec = ray->origin - a;
+	float u = tvec.dot(pvec) * invDet;
+	if (u < 0 || u > 1) return false;
+
+	vec3 qvec = tvec.cross(ab);
+	float v = ray->direction.dot(qvec) * invDet;
+	if (v < 0 || u + v > 1) return false;
+
+	float t = ac.dot(qvec) * invDet;
+
+	return t < ray->t && t >= EPSILON;
+}
+
+vec3 TriangleMesh::getNormal(int index)
+{
+	return vec3(this->normalX[index], this->normalY[index], this->normalZ[index]);
+}
+
+void TriangleMesh::getVertices(int index, vec3& a, vec3& b, vec3& c)
+{
+	const float* vertex = &this->vertices[this->indices[index * 3] * 3];
+	a = vec3(vertex[0], vertex[1], vertex[2]);
+	vertex = &this->vertices[this->indices[index * 3 + 1] * 3];
+	b = vec3(vertex[0], vertex[1], vertex[2]);
+	vertex = &this->vertices[this->indices[index * 3 + 2] * 3];
+	c = vec3(vertex[0], vertex[1], vertex[2]);
+}
+
+// the scalar tests of packed meshes derive the edges like the packets do, both give identical results
+void TriangleMesh::getEdges(int index, vec3& a, vec3& edge1, vec3& edge2)
+{
+	if (this->packed)
+	{
+		vec3 b, c;
+		this->getVertices(index, a, b, c);
+		edge1 = b - a;
+		edge2 = c - a;
+		return;
+	}
+
+	a = vec3(this->x[index], this->y[index], this->z[index]);
+	edge1 = vec3(this->edge1X[index], this->edge1Y[index], this->edge1Z[index]);
+	edge2 = vec3(this->edge2X[index], this->edge2Y[index], this->edge2Z[index]);
+}
+
+void TriangleMesh::calculateBounds(int index, BoundingBox& bounds)
+{
+	vec3 a, b, c;
+	this->getVertices(index, a, b, c);
+
+	bounds = BoundingBox(
+		vec3(MIN(MIN(a.x, b.x), c.x), MIN(MIN(a.y, b.y), c.y), MIN(MIN(a.z, b.z), c.z)),
+		vec3(MAX(MAX(a.x, b.x), c.x), MAX(MAX(a.y, b.y), c.y), MAX(MAX(a.z, b.z), c.z))
+	);
+}
+
+void TriangleMesh::clip(int index, const BoundingBox& bounds, int axis, float position, BoundingBox& left, BoundingBox& right)
+{
+	vec3 a, b, c;
+	this->getVertices(index, a, b, c);
+
+	Triangle::clip(a, b, c, bounds, axis, position, left, right);
+}
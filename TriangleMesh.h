@@ -0,0 +1,42 @@
+#pragma once
+namespace Tmpl8
+{
+	// triangles of a loaded model, referenced by their index from the leaves of the mesh BVH. The vertex and index
+	// buffers are the source of the geometry, bounds and clipping read them. Normals are stored in structure of arrays
+	// form. The first vertex and both edges leaving it, as used by the intersection test, are only stored as arrays
+	// when the BVH tests triangles one by one; with TRIANGLE_PACKET_WIDTH above 1 its packets hold them instead.
+	class TriangleMesh
+	{
+	public:
+		TriangleMesh(Material* material, std::vector<float>& vertices, std::vector<int>& indices);
+		TriangleMesh(Material* material, int count); // leaves the arrays to be filled, as by the mesh cache
+		~TriangleMesh();
+
+		Material* material;
+		int count;
+		bool packed; // only the normal arrays exist, positions and edges are in the packets of the BVH
+
+		std::vector<float> vertices; // x, y, z of every vertex, without the padding of vec3
+		std::vector<int> indices; // three per triangle
+
+		int stride; // floats per array, the arrays are one allocation that starts at normalX
+		float *normalX, *normalY, *normalZ;
+		float *x, *y, *z; // first vertex, NULL when packed
+		float *edge1X, *edge1Y, *edge1Z;
+		float *edge2X, *edge2Y, *edge2Z;
+
+		void intersect(int index, Ray* ray);
+		bool occludes(int index, Ray* ray);
+		vec3 getNormal(int index);
+		void getVertices(int index, vec3& a, vec3& b, vec3& c);
+		int getArraysCount(); // float arrays of stride floats, 3 when packed and 12 otherwise
+		size_t calculateMemoryUsage();
+
+		void calculateBounds(int index, BoundingBox& bounds);
+		void clip(int index, const BoundingBox& bounds, int axis, float position, BoundingBox& left, BoundingBox& right);
+
+	private:
+		void allocateArrays();
+		void getEdges(int index, vec3& a, vec3& edge1, vec3& edge2);
+	};
+}
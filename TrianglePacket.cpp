@@ -0,0 +1,172 @@
+#include "precomp.h"
+
+// -------------------- 4 WIDE ------------------------------------
+
+void TrianglePacket4::set(int lane, TriangleMesh* mesh, int index)
+{
+	this->index[lane] = index;
+	this->valid[lane] = index == -1 ? 0 : -1;
+
+	// unused lanes are masked out of the hits instead of relying on NaN comparisons, which fast math may break
+	if (index == -1)
+	{
+		for (int i = 0; i < 9; i++) this->triangles[i][lane] = 0;
+		return;
+	}
+
+	// the mesh keeps no positions or edges of its own when it is packed
+	vec3 a, b, c;
+	mesh->getVertices(index, a, b, c);
+	vec3 edge1 = b - a, edge2 = c - a;
+
+	this->triangles[0][lane] = a.x;
+	this->triangles[1][lane] = a.y;
+	this->triangles[2][lane] = a.z;
+	this->triangles[3][lane] = edge1.x;
+	this->triangles[4][lane] = edge1.y;
+	this->triangles[5][lane] = edge1.z;
+	this->triangles[6][lane] = edge2.x;
+	this->triangles[7][lane] = edge2.y;
+	this->triangles[8][lane] = edge2.z;
+}
+
+__m128 TrianglePacket4::calculateHits(Ray* ray, __m128& t)
+{
+	// same operations in the same order as TriangleMesh::intersect, lanes give identical results
+	const __m128 directionX = _mm_set1_ps(ray->direction.x), directionY = _mm_set1_ps(ray->direction.y), directionZ = _mm_set1_ps(ray->direction.z);
+	const __m128 edge1X = this->triangles4[3], edge1Y = this->triangles4[4], edge1Z = this->triangles4[5];
+	const __m128 edge2X = this->triangles4[6], edge2Y = this->triangles4[7], edge2Z = this->triangles4[8];
+
+	__m128 pX = _mm_sub_ps(_mm_mul_ps(directionY, edge2Z), _mm_mul_ps(directionZ, edge2Y));
+	__m128 pY = _mm_sub_ps(_mm_mul_ps(directionZ, edge2X), _mm_mul_ps(directionX, edge2Z));
+	__m128 pZ = _mm_sub_ps(_mm_mul_ps(directionX, edge2Y), _mm_mul_ps(directionY, edge2X));
+	__m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, pX), _mm_mul_ps(edge1Y, pY)), _mm_mul_ps(edge1Z, pZ));
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1), determinant);
+
+	__m128 tX = _mm_sub_ps(_mm_set1_ps(ray->origin.x), this->triangles4[0]);
+	__m128 tY = _mm_sub_ps(_mm_set1_ps(ray->origin.y), this->triangles4[1]);
+	__m128 tZ = _mm_sub_ps(_mm_set1_ps(ray->origin.z), this->triangles4[2]);
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tX, pX), _mm_mul_ps(tY, pY)), _mm_mul_ps(tZ, pZ)), invDet);
+
+	__m128 qX = _mm_sub_ps(_mm_mul_ps(tY, edge1Z), _mm_mul_ps(tZ, edge1Y));
+	__m128 qY = _mm_sub_ps(_mm_mul_ps(tZ, edge1X), _mm_mul_ps(tX, edge1Z));
+	__m128 qZ = _mm_sub_ps(_mm_mul_ps(tX, edge1Y), _mm_mul_ps(tY, edge1X));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qX), _mm_mul_ps(directionY, qY)), _mm_mul_ps(directionZ, qZ)), invDet);
+	t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)), _mm_mul_ps(edge2Z, qZ)), invDet);
+
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+	__m128 hits = _mm_and_ps(this->valid4, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+	hits = _mm_and_ps(hits, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+	hits = _mm_and_ps(hits, _mm_and_ps(_mm_cmplt_ps(t, _mm_set1_ps(ray->t)), _mm_cmpge_ps(t, _mm_set1_ps((float)EPSILON))));
+
+	return hits;
+}
+
+int TrianglePacket4::intersect(Ray* ray, float& t)
+{
+	__m128 distances;
+	__m128 hits = this->calculateHits(ray, distances);
+	int mask = _mm_movemask_ps(hits);
+	if (mask == 0) return -1;
+
+	// closest hit of all lanes, ties go to the lowest lane like the sequential tests
+	distances = _mm_or_ps(_mm_and_ps(hits, distances), _mm_andnot_ps(hits, _mm_set1_ps(INFINITY)));
+	__m128 closest = _mm_min_ps(distances, _mm_shuffle_ps(distances, distances, _MM_SHUFFLE(2, 3, 0, 1)));
+	closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(1, 0, 3, 2)));
+
+	int lane = 0;
+	for (mask = _mm_movemask_ps(_mm_cmpeq_ps(distances, closest)) & mask; !(mask & 1); mask >>= 1) lane++;
+
+	t = _mm_cvtss_f32(closest);
+	return lane;
+}
+
+bool TrianglePacket4::occludes(Ray* ray)
+{
+	__m128 distances;
+	return _mm_movemask_ps(this->calculateHits(ray, distances)) != 0;
+}
+
+// -------------------- 8 WIDE ------------------------------------
+
+void TrianglePacket8::set(int lane, TriangleMesh* mesh, int index)
+{
+	this->index[lane] = index;
+	this->valid[lane] = index == -1 ? 0 : -1;
+
+	if (index == -1)
+	{
+		for (int i = 0; i < 9; i++) this->triangles[i][lane] = 0;
+		return;
+	}
+
+	vec3 a, b, c;
+	mesh->getVertices(index, a, b, c);
+	vec3 edge1 = b - a, edge2 = c - a;
+
+	this->triangles[0][lane] = a.x;
+	this->triangles[1][lane] = a.y;
+	this->triangles[2][lane] = a.z;
+	this->triangles[3][lane] = edge1.x;
+	this->triangles[4][lane] = edge1.y;
+	this->triangles[5][lane] = edge1.z;
+	this->triangles[6][lane] = edge2.x;
+	this->triangles[7][lane] = edge2.y;
+	this->triangles[8][lane] = edge2.z;
+}
+
+__m256 TrianglePacket8::calculateHits(Ray* ray, __m256& t)
+{
+	const __m256 directionX = _mm256_set1_ps(ray->direction.x), directionY = _mm256_set1_ps(ray->direction.y), directionZ = _mm256_set1_ps(ray->direction.z);
+	const __m256 edge1X = this->triangles8[3], edge1Y = this->triangles8[4], edge1Z = this->triangles8[5];
+	const __m256 edge2X = this->triangles8[6], edge2Y = this->triangles8[7], edge2Z = this->triangles8[8];
+
+	__m256 pX = _mm256_sub_ps(_mm256_mul_ps(directionY, edge2Z), _mm256_mul_ps(directionZ, edge2Y));
+	__m256 pY = _mm256_sub_ps(_mm256_mul_ps(directionZ, edge2X), _mm256_mul_ps(directionX, edge2Z));
+	__m256 pZ = _mm256_sub_ps(_mm256_mul_ps(directionX, edge2Y), _mm256_mul_ps(directionY, edge2X));
+	__m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge1X, pX), _mm256_mul_ps(edge1Y, pY)), _mm256_mul_ps(edge1Z, pZ));
+	__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1), determinant);
+
+	__m256 tX = _mm256_sub_ps(_mm256_set1_ps(ray->origin.x), this->triangles8[0]);
+	__m256 tY = _mm256_sub_ps(_mm256_set1_ps(ray->origin.y), this->triangles8[1]);
+	__m256 tZ = _mm256_sub_ps(_mm256_set1_ps(ray->origin.z), this->triangles8[2]);
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tX, pX), _mm256_mul_ps(tY, pY)), _mm256_mul_ps(tZ, pZ)), invDet);
+
+	__m256 qX = _mm256_sub_ps(_mm256_mul_ps(tY, edge1Z), _mm256_mul_ps(tZ, edge1Y));
+	__m256 qY = _mm256_sub_ps(_mm256_mul_ps(tZ, edge1X), _mm256_mul_ps(tX, edge1Z));
+	__m256 qZ = _mm256_sub_ps(_mm256_mul_ps(tX, edge1Y), _mm256_mul_ps(tY, edge1X));
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(directionX, qX), _mm256_mul_ps(directionY, qY)), _mm256_mul_ps(directionZ, qZ)), invDet);
+	t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge2X, qX), _mm256_mul_ps(edge2Y, qY)), _mm256_mul_ps(edge2Z, qZ)), invDet);
+
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1);
+	__m256 hits = _mm256_and_ps(this->valid8, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+	hits = _mm256_and_ps(hits, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+	hits = _mm256_and_ps(hits, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(ray->t), _CMP_LT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps((float)EPSILON), _CMP_GE_OQ)));
+
+	return hits;
+}
+
+int TrianglePacket8::intersect(Ray* ray, float& t)
+{
+	__m256 distances;
+	__m256 hits = this->calculateHits(ray, distances);
+	int mask = _mm256_movemask_ps(hits);
+	if (mask == 0) return -1;
+
+	distances = _mm256_blendv_ps(_mm256_set1_ps(INFINITY), distances, hits);
+	__m256 closest = _mm256_min_ps(distances, _mm256_permute_ps(distances, _MM_SHUFFLE(2, 3, 0, 1)));
+	closest = _mm256_min_ps(closest, _mm256_permute_ps(closest, _MM_SHUFFLE(1, 0, 3, 2)));
+	closest = _mm256_min_ps(closest, _mm256_permute2f128_ps(closest, closest, 1));
+
+	int lane = 0;
+	for (mask = _mm256_movemask_ps(_mm256_cmp_ps(distances, closest, _CMP_EQ_OQ)) & mask; !(mask & 1); mask >>= 1) lane++;
+
+	t = _mm256_cvtss_f32(closest);
+	return lane;
+}
+
+bool TrianglePacket8::occludes(Ray* ray)
+{
+	__m256 distances;
+	return _mm256_movemask_ps(this->calculateHits(ray, distances)) != 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+namespace Tmpl8
+{
+	// 4 mesh triangles in SoA form, intersected with a single SSE Moller-Trumbore test.
+	// Leaves of mesh BVHs store their triangles as consecutive packets, unused lanes are masked out of the hits.
+	class alignas(64) TrianglePacket4
+	{
+	public:
+		static const int WIDTH = 4;
+
+		union { __m128 triangles4[9]; float triangles[9][4]; }; // x, y, z of the first vertex, edge1 x, y, z, edge2 x, y, z
+		union { __m128 valid4; int valid[4]; }; // all bits set for lanes holding a triangle, zero for unused lanes
+		int index[4]; // triangle index within the mesh, -1 for unused lanes
+
+		void set(int lane, TriangleMesh* mesh, int index);
+		int intersect(Ray* ray, float& t);
+		bool occludes(Ray* ray);
+
+	private:
+		__m128 calculateHits(Ray* ray, __m128& t);
+	};
+
+	// 8-wide packet, same layout as TrianglePacket4 with AVX registers
+	class alignas(64) TrianglePacket8
+	{
+	public:
+		static const int WIDTH = 8;
+
+		union { __m256 triangles8[9]; float triangles[9][8]; };
+		union { __m256 valid8; int valid[8]; };
+		int index[8];
+
+		void set(int lane, TriangleMesh* mesh, int index);
+		int intersect(Ray* ray, float& t);
+		bool occludes(Ray* ray);
+
+	private:
+		__m256 calculateHits(Ray* ray, __m256& t);
+	};
+}
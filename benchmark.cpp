@@ -0,0 +1,197 @@
+// benchmark entry point: renders fixed views of the bundled assets and reports ray throughput, BVH build
+// times and scene memory as JSON or CSV. Built by the benchmark target of the makefile with HEADLESS defined.
+
+#include "precomp.h"
+#include <unistd.h>
+
+struct BenchmarkResult
+{
+	const char* scene;
+	int primitives;
+	float loadTime, buildTime, renderTime; // milliseconds
+	Scene::RayCounters rays;
+	float sceneMemory; // megabytes allocated by the BVHs, meshes and instances of the scene
+	double meanLuminance; // changes when the rendered image does
+};
+
+static void printUsage()
+{
+	printf("usage: path-tracer-bench [options]\n");
+	printf("  -n, --samples N      samples per pixel (default 4)\n");
+	printf("  -t, --threads N      worker threads, 0 uses all hardware threads (default 0)\n");
+	printf("      --cache on|off   load models from their mesh caches, off parses and builds them every run (default off)\n");
+	printf("  -f, --format NAME    json or csv (default json)\n");
+	printf("  -o, --output FILE    write the results to a file instead of stdout\n");
+	printf("  -h, --help           print this message\n");
+}
+
+static double getSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double getMillionRaysPerSecond(long long rays, float milliseconds)
+{
+	return milliseconds > 0 ? rays / (milliseconds * 1000.0) : 0;
+}
+
+static void writeJSON(FILE* file, std::vector<BenchmarkResult>& results, int samples, int threads)
+{
+	fprintf(file, "{\n");
+	fprintf(file, "  \"width\": %d,\n  \"height\": %d,\n  \"samples\": %d,\n  \"threads\": %d,\n", SCRWIDTH, SCRHEIGHT, samples, threads);
+	fprintf(file, "  \"scenes\": [\n");
+	for (int i = 0; i < results.size(); i++)
+	{
+		BenchmarkResult& result = results[i];
+		long long totalRays = result.rays.primary + result.rays.secondary + result.rays.shadow;
+		fprintf(file, "    {\n");
+		fprintf(file, "      \"scene\": \"%s\",\n", result.scene);
+		fprintf(file, "      \"primitives\": %d,\n", result.primitives);
+		fprintf(file, "      \"load_ms\": %.3f,\n", result.loadTime);
+		fprintf(file, "      \"bvh_build_ms\": %.3f,\n", result.buildTime);
+		fprintf(file, "      \"render_ms\": %.3f,\n", result.renderTime);
+		fprintf(file, "      \"primary_rays\": %lld,\n", result.rays.primary);
+		fprintf(file, "      \"secondary_rays\": %lld,\n", result.rays.secondary);
+		fprintf(file, "      \"shadow_rays\": %lld,\n", result.rays.shadow);
+		fprintf(file, "      \"primary_mrays_per_s\": %.3f,\n", getMillionRaysPerSecond(result.rays.primary, result.renderTime));
+		fprintf(file, "      \"secondary_mrays_per_s\": %.3f,\n", getMillionRaysPerSecond(result.rays.secondary, result.renderTime));
+		fprintf(file, "      \"shadow_mrays_per_s\": %.3f,\n", getMillionRaysPerSecond(result.rays.shadow, result.renderTime));
+		fprintf(file, "      \"total_mrays_per_s\": %.3f,\n", getMillionRaysPerSecond(totalRays, result.renderTime));
+		fprintf(file, "      \"scene_memory_mb\": %.1f,\n", result.sceneMemory);
+		fprintf(file, "      \"mean_luminance\": %.6f\n", result.meanLuminance);
+		fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+}
+
+static void writeCSV(FILE* file, std::vector<BenchmarkResult>& results, int samples, int threads)
+{
+	fprintf(file, "scene,width,height,samples,threads,primitives,load_ms,bvh_build_ms,render_ms,primary_rays,secondary_rays,shadow_rays,"
+		"primary_mrays_per_s,secondary_mrays_per_s,shadow_mrays_per_s,total_mrays_per_s,scene_memory_mb,mean_luminance\n");
+	for (int i = 0; i < results.size(); i++)
+	{
+		BenchmarkResult& result = results[i];
+		long long totalRays = result.rays.primary + result.rays.secondary + result.rays.shadow;
+		fprintf(file, "%s,%d,%d,%d,%d,%d,%.3f,%.3f,%.3f,%lld,%lld,%lld,%.3f,%.3f,%.3f,%.3f,%.1f,%.6f\n",
+			result.scene, SCRWIDTH, SCRHEIGHT, samples, threads, result.primitives,
+			result.loadTime, result.buildTime, result.renderTime,
+			result.rays.primary, result.rays.secondary, result.rays.shadow,
+			getMillionRaysPerSecond(result.rays.primary, result.renderTime),
+			getMillionRaysPerSecond(result.rays.secondary, result.renderTime),
+			getMillionRaysPerSecond(result.rays.shadow, result.renderTime),
+			getMillionRaysPerSecond(totalRays, result.renderTime),
+			result.sceneMemory, result.meanLuminance);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* format = "json";
+	const char* outputFile = NULL;
+	int samples = 4, threads = 0;
+
+	// load and build times are only comparable when every run parses and builds the models
+	MeshCache::enabled = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* option = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!strcmp(option, "-h") || !strcmp(option, "--help"))
+		{
+			printUsage();
+			return 0;
+		}
+		if (!value)
+		{
+			printf("Missing value of %s\n", option);
+			printUsage();
+			return 1;
+		}
+
+		if (!strcmp(option, "-n") || !strcmp(option, "--samples")) samples = atoi(value);
+		else if (!strcmp(option, "-t") || !strcmp(option, "--threads")) threads = atoi(value);
+		else if (!strcmp(option, "--cache")) MeshCache::enabled = !strcmp(value, "on");
+		else if (!strcmp(option, "-f") || !strcmp(option, "--format")) format = value;
+		else if (!strcmp(option, "-o") || !strcmp(option, "--output")) outputFile = value;
+		else
+		{
+			printf("Unknown option %s\n", option);
+			printUsage();
+			return 1;
+		}
+		i++;
+	}
+
+	if (samples < 1 || threads < 0 || (strcmp(format, "json") && strcmp(format, "csv")))
+	{
+		printUsage();
+		return 1;
+	}
+
+	// scene loading reports on stdout, so the results get their own copy of it and everything else goes to stderr
+	FILE* file = outputFile ? fopen(outputFile, "w") : fdopen(dup(fileno(stdout)), "w");
+	if (!file)
+	{
+		printf("Could not write %s\n", outputFile);
+		return 1;
+	}
+	fflush(stdout);
+	dup2(fileno(stderr), fileno(stdout));
+
+	JobManager::CreateJobManager(threads);
+	threads = JobManager::GetJobManager()->GetNumThreads();
+
+	Surface* screen = new Surface(SCRWIDTH, SCRHEIGHT);
+	Scene* scene = new Scene(screen);
+	TileRenderer* tileRenderer = new TileRenderer(scene);
+
+	// the samplers are deterministic, every run traces the same rays given the sample count
+	const char* scenes[] = { "teapot", "teddy", "cow", "pumpkin", "nice" };
+	std::vector<BenchmarkResult> results;
+	for (int i = 0; i < sizeof(scenes) / sizeof(scenes[0]); i++)
+	{
+		BenchmarkResult result;
+		result.scene = scenes[i];
+
+		printf("%s: loading\n", scenes[i]);
+		double start = getSeconds();
+		DemoScenes::load(scene, scenes[i]);
+		result.loadTime = (float)((getSeconds() - start) * 1000);
+		result.buildTime = scene->getBVHBuildTime();
+		result.primitives = scene->getPrimitivesCount();
+		result.sceneMemory = scene->getMemoryUsage() / (1024.0f * 1024.0f);
+
+		scene->setSampler(sobolSampler);
+		scene->resetRayCounters();
+
+		printf("%s: rendering %d samples per pixel on %d threads\n", scenes[i], samples * STRATA_SIZE * STRATA_SIZE, threads);
+		start = getSeconds();
+		for (int sample = 0; sample < samples; sample++)
+		{
+			scene->increaseAccumulator();
+			tileRenderer->render();
+		}
+		result.renderTime = (float)((getSeconds() - start) * 1000);
+		result.rays = scene->getRayCounters();
+
+		result.meanLuminance = 0;
+		for (int y = 0; y < SCRHEIGHT; y++)
+		{
+			for (int x = 0; x < SCRWIDTH; x++)
+			{
+				vec4 color = scene->getAccumulatedColor(x, y);
+				result.meanLuminance += 0.2126 * color.x + 0.7152 * color.y + 0.0722 * color.z;
+			}
+		}
+		result.meanLuminance /= SCRWIDTH * SCRHEIGHT;
+
+		results.push_back(result);
+	}
+
+	if (!strcmp(format, "json")) writeJSON(file, results, samples, threads);
+	else writeCSV(file, results, samples, threads);
+
+	return fclose(file) == 0 ? 0 : 1;
+}
@@ -4,18 +4,8 @@ int frame, sceneId, movingModelId;
 float cameraSpeed = 0.2;
 timer _timer;
 
-RayTracerJob** rayTracerJobs;
-JobManager* jobManager;
-
 Scene* scene;
-
-void RayTracerJob::Main()
-{
-	for (uint i = start; i < end; i++)
-	{
-		scene->render(i);
-	}
-}
+TileRenderer* tileRenderer;
 
 // -----------------------------------------------------------
 // Initialize the application
@@ -33,17 +23,11 @@ void Game::Init()
 	printf("--------------------------------------------------\n");
 
 	// initialize threads
-	rayTracerJobs = new RayTracerJob*[SCRHEIGHT / 32];
-	for (int i = 0; i < SCRHEIGHT / 32; i++)
-	{
-		rayTracerJobs[i] = new RayTracerJob(i * 32, (i + 1) * 32);
-	}
-
-	JobManager::CreateJobManager(4);
-	jobManager = JobManager::GetJobManager();
+	JobManager::CreateJobManager();
 
 	//create scene
 	scene = new Scene(screen);
+	tileRenderer = new TileRenderer(scene);
 	//this->loadTeddy();
 	this->loadNiceScene();
 }
@@ -68,21 +52,7 @@ void Game::Tick( float deltaTime )
 	// path tracer accumulator
 	scene->increaseAccumulator();
 
-	if (MULTITHREADING_ENABLED)
-	{
-		for (int i = 0; i < SCRHEIGHT / 32; i++)
-		{
-			jobManager->AddJob2(rayTracerJobs[i]);
-		}
-		jobManager->RunJobs();
-	}
-	else
-	{
-		for (uint i = 0; i < SCRHEIGHT; i++)
-		{
-			scene->render(i);
-		}
-	}
+	tileRenderer->render();
 
 	// calculate frame
 	frame++;
@@ -99,6 +69,11 @@ void Game::Tick( float deltaTime )
 
 	sprintf(buffer, "Primitives: %i", scene->getPrimitivesCount());
 	screen->Print(buffer, 2, 12, 0xffffff);
+
+	// per tile timing, a long tail means workers were idle at the end of the frame
+	char tilesBuffer[64];
+	sprintf(tilesBuffer, "Slowest tile: %.2f ms, tail: %.2f ms", tileRenderer->slowestTile, tileRenderer->tailTime);
+	screen->Print(tilesBuffer, 2, 22, 0xffffff);
 }
 
 void Game::handleInput()
@@ -223,182 +198,26 @@ void Game::loadSimpleScene()
 {
 	sceneId = 0;
 	cameraSpeed = 1;
-	scene->clear();
-	scene->camera->reset();
-
-	scene->camera->position = vec3(0, 11, -67);
-	scene->camera->up = vec3(0, 0.9, 0.15);
-	scene->camera->right = vec3(0.9, 0, 0);
-	scene->camera->calculateScreen();
-
-	scene->loadSkydome("assets/skydome/space.hdr");
-
-	// lights
-	scene->addLightSource(new SphericalLight(vec3(-5, 40, -20), 4, vec4(1, 1, 1, 1), 25));
-
-	// materials
-	Material* floorMaterial = new Material(vec4(0.5, 0.5, 0.5, 1.0), diffuse);
-	Material* wallMaterial = new Material(vec4(0.5, 0.5, 0.5, 1.0), diffuse);
-
-	Material* redMaterial = new Material(vec4(0.8, 0.21, 0.19, 1), diffuse);
-	Material* mirrorMaterial = new Material(vec4(0.75, 0.8, 0.7, 1), mirror);
-
-	Material* glassMaterial = new Material(vec4(0.25, 0.75, 0.25, 1), dielectric);
-	glassMaterial->refraction = 1.33;
-	glassMaterial->reflection = 0.5;
-
-	// room
-	int roomWidth = 50;
-	int roomHeigth = 50;
-
-	// floor
-	scene->addPrimitive(new Plane(floorMaterial, vec3(roomWidth, -10, 10), vec3(0, 1, 0), 100));
-
-	scene->addPrimitive(new Sphere(mirrorMaterial, vec3(-5, 0, -10), 5));
-	scene->addPrimitive(new Sphere(redMaterial, vec3(-5, 0, -20), 4));
-	scene->addPrimitive(new Sphere(glassMaterial, vec3(-5, -5, -30), 5));
+	DemoScenes::loadSimple(scene);
 }
 
 void Game::loadNiceScene()
 {
-	// https://groups.csail.mit.edu/graphics/classes/6.837/F03/models/
-	//movingModelId = scene->loadModel("assets/cube.obj", brownMaterial);
-
-	// reset scene
 	sceneId = 0;
 	cameraSpeed = 1;
-	scene->clear();
-	scene->camera->reset();
-
-	scene->camera->position = vec3(0, 15, -90);
-	scene->camera->up = vec3(0, 0.9, 0.15);
-	scene->camera->right = vec3(1, 0, 0);
-	scene->camera->calculateScreen();
-
-	scene->loadSkydome("assets/skydome/space.hdr");
-
-	// scene lights
-	scene->addLightSource(new SphericalLight(vec3(-5, 30, -20), 2, vec4(1, 1, 1, 1), 125));
-	scene->addLightSource(new SphericalLight(vec3(15, 30, -20), 1, vec4(1, 1, 1, 1), 100));
-	scene->addLightSource(new SphericalLight(vec3(0, -10, -20), 2, vec4(0.85, 0.83, 0.12, 1), 25));
-
-	// materials
-	Material* floorMaterial = new Material(vec4(0.5, 0.5, 0.5, 1.0), diffuse);
-	Material* whiteMaterial = new Material(vec4(1, 1, 1, 1), diffuse);
-	Material* wallMaterial = new Material(vec4(0.09, 0.63, 0.52, 1), diffuse);
-
-	Material* glassMaterial = new Material(vec4(0.78, 0.85, 0.86, 1), dielectric);
-	glassMaterial->refraction = 1.33;
-	glassMaterial->reflection = 0.5;
-
-	Material* redGlassMaterial = new Material(vec4(1, 0.25, 0.25, 1), dielectric);
-	redGlassMaterial->refraction = 1.33;
-	redGlassMaterial->reflection = 0.5;
-
-	Material* mirrorMaterial = new Material(vec4(0.75, 0.8, 0.7, 1), mirror);
-	Material* orangeMaterial = new Material(vec4(0.95, 0.61, 0.07, 1), diffuse);
-	Material* redMaterial = new Material(vec4(0.8, 0.21, 0.19, 1), diffuse);
-
-	int roomWidth = 50;
-	int roomHeigth = 10;
-
-	// floor
-	//scene->addPrimitive(new Triangle(floorMaterial, vec3(-roomWidth, -10, -100), vec3(-roomWidth, -10, 10), vec3(roomWidth, -10, 10)));
-	//scene->addPrimitive(new Triangle(floorMaterial, vec3(roomWidth, -10, -100), vec3(-roomWidth, -10, -100), vec3(roomWidth, -10, 10)));
-	scene->addPrimitive(new Plane(floorMaterial, vec3(roomWidth, -10, 10), vec3(0, 1, 0), 100));
-	
-	// walls
-	scene->addPrimitive(new Triangle(mirrorMaterial, vec3(roomWidth, -roomHeigth, 10), vec3(-roomWidth, -roomHeigth, 10), vec3(roomWidth, roomHeigth, 10)));
-	scene->addPrimitive(new Triangle(mirrorMaterial, vec3(-roomWidth, -roomHeigth, 10), vec3(-roomWidth, roomHeigth, 10), vec3(roomWidth, roomHeigth, 10)));
-
-	/*scene->addPrimitive(new Triangle(wallMaterial, vec3(roomWidth, -roomHeigth, -100), vec3(roomWidth, -roomHeigth, 10), vec3(roomWidth, roomHeigth, 10)));
-	scene->addPrimitive(new Triangle(wallMaterial, vec3(roomWidth, roomHeigth, -100), vec3(roomWidth, -roomHeigth, -100), vec3(roomWidth, roomHeigth, 10)));
-
-	scene->addPrimitive(new Triangle(wallMaterial, vec3(-roomWidth, -roomHeigth, 10), vec3(-roomWidth, -roomHeigth, -100), vec3(-roomWidth, roomHeigth, 10)));
-	scene->addPrimitive(new Triangle(wallMaterial, vec3(-roomWidth, -roomHeigth, -100), vec3(-roomWidth, roomHeigth, -100), vec3(-roomWidth, roomHeigth, 10)));
-
-	scene->addPrimitive(new Triangle(wallMaterial, vec3(-roomWidth, -roomHeigth, -100), vec3(roomWidth, -roomHeigth, -100), vec3(roomWidth, roomHeigth, -100)));
-	scene->addPrimitive(new Triangle(wallMaterial, vec3(-roomWidth, roomHeigth, -100), vec3(-roomWidth, -roomHeigth, -100), vec3(roomWidth, roomHeigth, -100)));
-	//*/
-
-	// teapots
-	Material* purpleMaterial = new Material(vec4(0.67, 0.37, 0.87, 0), diffuse);
-
-	scene->loadModel("assets/teapot.obj", purpleMaterial, vec3(-10, -7, -40));
-	scene->addPrimitive(new Sphere(whiteMaterial, vec3(-10, -12, -40), 5));
-
-	scene->loadModel("assets/teapot.obj", redGlassMaterial, vec3(EPSILON, -10, -50));
-
-	scene->loadModel("assets/teapot.obj", purpleMaterial, vec3(10, -7, -40));
-	scene->addPrimitive(new Sphere(whiteMaterial, vec3(10, -12, -40), 5));
-
-	// sphere with torus
-	scene->addPrimitive(new Sphere(redMaterial, vec3(0, 0, -10), 5));
-	scene->addPrimitive(new Torus(orangeMaterial, 7, 1, vec3(0, 0, -10), vec3(-1, -1.5, 0)));
-
-	// cylinders
-	scene->addPrimitive(new Cylinder(redMaterial, vec3(-10, -10, -20), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(glassMaterial, vec3(-13, -10, -22), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(redMaterial, vec3(-16, -10, -24), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(glassMaterial, vec3(-19, -10, -26), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(redMaterial, vec3(-22, -10, -28), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(glassMaterial, vec3(-25, -10, -30), vec3(0, 1, 0), 0.5, 30));
-
-	scene->addPrimitive(new Cylinder(redMaterial, vec3(10, -10, -20), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(glassMaterial, vec3(13, -10, -22), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(redMaterial, vec3(16, -10, -24), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(glassMaterial, vec3(19, -10, -26), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(redMaterial, vec3(22, -10, -28), vec3(0, 1, 0), 0.5, 30));
-	scene->addPrimitive(new Cylinder(glassMaterial, vec3(25, -10, -30), vec3(0, 1, 0), 0.5, 30));
+	DemoScenes::loadNice(scene);
 }
 
 void Game::loadTeddy()
 {
 	sceneId = 1;
 	cameraSpeed = 1;
-	scene->clear();
-
-	scene->camera->reset();
-	scene->camera->position = vec3(-32, 0, 40);
-	scene->camera->up = vec3(0, 1, 0);
-	scene->camera->right = vec3(-0.77, 0, -0.62);
-	scene->camera->calculateScreen();
-
-	scene->loadSkydome("assets/skydome/space.hdr");
-
-	scene->addLightSource(new DirectLight(vec3(-10.0f, 0.0f, 20.0), vec4(1, 1, 1, 0), 250));
-
-	Material* redMaterial = new Material(vec4(1, 0, 0, 0), diffuse);
-	scene->addPrimitive(
-		new Sphere(redMaterial, vec3(-25, 10, 0), 5)
-	);
-
-	Material* brownMaterial = new Material(vec4(1, 0.8, 0.5, 0), diffuse);
-	for (int i = 0; i < 3; i++)
-	{
-		scene->loadModel("assets/teddy.obj", brownMaterial, vec3(i * 40, 0, 0));
-	}
+	DemoScenes::loadTeddy(scene);
 }
 
 void Game::loadTeapot()
 {
 	sceneId = 2;
 	cameraSpeed = 0.5;
-	scene->clear();
-
-	scene->camera->reset();
-	scene->camera->position = vec3(-20, -0.013, 20);
-	scene->camera->up = vec3(0, 1, 0);
-	scene->camera->right = vec3(-0.921, 0, -0.387);
-	scene->camera->calculateScreen();
-
-	scene->loadSkydome("assets/skydome/space.hdr");
-
-	scene->addLightSource(new DirectLight(vec3(-10.0f, 0.0f, 20.0), vec4(1, 1, 1, 0), 250));
-
-	Material* brownMaterial = new Material(vec4(1, 0.8, 0.5, 0), diffuse);
-	for (int i = 0; i < 10; i++)
-	{
-		scene->loadModel("assets/teapot.obj", brownMaterial, vec3(i * 7, 0, 0));
-	}
+	DemoScenes::loadTeapot(scene);
 }
\ No newline at end of file
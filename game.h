@@ -25,14 +25,4 @@ private:
 	void loadTeapot();
 };
 
-class RayTracerJob : public Job
-{
-public:
-	RayTracerJob(int start, int end) : start(start), end(end) {};
-	void Main();
-private:
-	int start;
-	int end;
-};
-
 }; // namespace Tmpl8
\ No newline at end of file
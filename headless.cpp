@@ -0,0 +1,159 @@
+// headless entry point: renders a scene on all cores without a window and writes the result to disk.
+// Built by the headless target of the makefile with HEADLESS defined, it does not link SDL, OpenGL or Win32.
+
+#include "precomp.h"
+
+static void printUsage()
+{
+	printf("usage: path-tracer-cli [options]\n");
+	printf("  -s, --scene NAME     simple, nice, teddy, teapot, cow or pumpkin (default nice)\n");
+	printf("  -n, --samples N      samples per pixel (default 16)\n");
+	printf("  -t, --threads N      worker threads, 0 uses all hardware threads (default 0)\n");
+	printf("  -o, --output FILE    .pfm writes the linear HDR accumulator, .ppm a tone mapped preview (default render.pfm)\n");
+	printf("      --sampler NAME   random, sobol or rank1 (default sobol)\n");
+	printf("  -h, --help           print this message\n");
+}
+
+static bool hasExtension(const char* fileName, const char* extension)
+{
+	int length = strlen(fileName), extensionLength = strlen(extension);
+	return length >= extensionLength && !strcmp(fileName + length - extensionLength, extension);
+}
+
+// portable float map, rows go from bottom to top, a negative scale marks little endian data
+static bool writePFM(const char* fileName, Scene* scene)
+{
+	FILE* file = fopen(fileName, "wb");
+	if (!file) return false;
+
+	fprintf(file, "PF\n%d %d\n-1.0\n", SCRWIDTH, SCRHEIGHT);
+
+	std::vector<float> line(3 * SCRWIDTH);
+	for (int y = SCRHEIGHT - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < SCRWIDTH; x++)
+		{
+			vec4 color = scene->getAccumulatedColor(x, y);
+			line[3 * x] = color.x;
+			line[3 * x + 1] = color.y;
+			line[3 * x + 2] = color.z;
+		}
+		fwrite(&line[0], sizeof(float), line.size(), file);
+	}
+
+	return fclose(file) == 0;
+}
+
+// binary portable pixmap of the screen, which holds the tone mapped accumulator
+static bool writePPM(const char* fileName, Surface* screen)
+{
+	FILE* file = fopen(fileName, "wb");
+	if (!file) return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", SCRWIDTH, SCRHEIGHT);
+
+	std::vector<unsigned char> line(3 * SCRWIDTH);
+	for (int y = 0; y < SCRHEIGHT; y++)
+	{
+		Pixel* pixels = screen->GetBuffer() + y * screen->GetPitch();
+		for (int x = 0; x < SCRWIDTH; x++)
+		{
+			line[3 * x] = (pixels[x] >> 16) & 255;
+			line[3 * x + 1] = (pixels[x] >> 8) & 255;
+			line[3 * x + 2] = pixels[x] & 255;
+		}
+		fwrite(&line[0], 1, line.size(), file);
+	}
+
+	return fclose(file) == 0;
+}
+
+int main(int argc, char** argv)
+{
+	const char* sceneName = "nice";
+	const char* outputFile = "render.pfm";
+	int samples = 16, threads = 0;
+	SamplerType samplerType = sobolSampler;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* option = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!strcmp(option, "-h") || !strcmp(option, "--help"))
+		{
+			printUsage();
+			return 0;
+		}
+		if (!value)
+		{
+			printf("Missing value of %s\n", option);
+			printUsage();
+			return 1;
+		}
+
+		if (!strcmp(option, "-s") || !strcmp(option, "--scene")) sceneName = value;
+		else if (!strcmp(option, "-n") || !strcmp(option, "--samples")) samples = atoi(value);
+		else if (!strcmp(option, "-t") || !strcmp(option, "--threads")) threads = atoi(value);
+		else if (!strcmp(option, "-o") || !strcmp(option, "--output")) outputFile = value;
+		else if (!strcmp(option, "--sampler"))
+		{
+			if (!strcmp(value, "random")) samplerType = randomSampler;
+			else if (!strcmp(value, "sobol")) samplerType = sobolSampler;
+			else if (!strcmp(value, "rank1")) samplerType = rankOneSampler;
+			else
+			{
+				printf("Unknown sampler %s\n", value);
+				return 1;
+			}
+		}
+		else
+		{
+			printf("Unknown option %s\n", option);
+			printUsage();
+			return 1;
+		}
+		i++;
+	}
+
+	if (samples < 1 || threads < 0 || (!hasExtension(outputFile, ".pfm") && !hasExtension(outputFile, ".ppm")))
+	{
+		printUsage();
+		return 1;
+	}
+
+	JobManager::CreateJobManager(threads);
+
+	Surface* screen = new Surface(SCRWIDTH, SCRHEIGHT);
+	Scene* scene = new Scene(screen);
+	if (!DemoScenes::load(scene, sceneName))
+	{
+		printf("Unknown scene %s\n", sceneName);
+		return 1;
+	}
+	scene->setSampler(samplerType);
+
+	TileRenderer* tileRenderer = new TileRenderer(scene);
+	printf("Rendering %s at %dx%d, %d samples per pixel on %d threads\n", sceneName, SCRWIDTH, SCRHEIGHT, samples * STRATA_SIZE * STRATA_SIZE, JobManager::GetJobManager()->GetNumThreads());
+
+	float renderTime = 0;
+	for (int sample = 0; sample < samples; sample++)
+	{
+		scene->increaseAccumulator();
+		tileRenderer->render();
+		renderTime += tileRenderer->frameTime;
+
+		printf("sample %d/%d: %.1f ms, slowest tile %.2f ms, tail %.2f ms\n", sample + 1, samples, tileRenderer->frameTime, tileRenderer->slowestTile, tileRenderer->tailTime);
+	}
+	printf("Rendered in %.2f s\n", renderTime / 1000);
+
+	bool written = hasExtension(outputFile, ".pfm") ? writePFM(outputFile, scene) : writePPM(outputFile, screen);
+	if (!written)
+	{
+		printf("Could not write %s\n", outputFile);
+		return 1;
+	}
+	printf("Wrote %s\n", outputFile);
+
+	return 0;
+}
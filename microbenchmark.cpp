@@ -0,0 +1,338 @@
+// microbenchmark entry point: measures the intersection kernels and the BVH node test in isolation over
+// pre-generated ray batches. Built by the microbenchmark target of the makefile with HEADLESS defined. It also checks
+// the float torus kernel against the double precision quartic solver and exits with 1 when they disagree.
+
+#include "precomp.h"
+#include <unistd.h>
+#include <x86intrin.h>
+
+#define CANDIDATE_ATTEMPTS 64 // candidate rays per batch ray before giving up on filling a pool
+#define TORUS_MAX_MISMATCH_RATIO 1e-3 // share of the rays the float torus kernel may classify differently from the reference
+#define TORUS_MAX_RELATIVE_ERROR 1e-4 // mean relative deviation of the hit distances allowed against the reference
+
+struct KernelResult
+{
+	const char* kernel;
+	const char* call; // direct on the final class, virtual through Primitive or switch through PrimitiveArrays
+	long long tests, hits;
+	double nanoseconds, cycles; // per test
+};
+
+static void printUsage()
+{
+	printf("usage: path-tracer-microbench [options]\n");
+	printf("  -r, --rays N         rays per batch (default 4096)\n");
+	printf("      --hit-ratio F    fraction of the batch that hits the tested object (default 0.5)\n");
+	printf("      --min-time MS    measuring time per kernel in milliseconds (default 200)\n");
+	printf("  -f, --format NAME    json or csv (default json)\n");
+	printf("  -o, --output FILE    write the results to a file instead of stdout\n");
+	printf("  -h, --help           print this message\n");
+}
+
+static double getSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static vec3 getRandomDirection(RandomGenerator& random)
+{
+	float z = 1 - 2 * random.uniform();
+	float r = sqrtf(MAX(0.0f, 1 - z * z));
+	float phi = 2 * PI * random.uniform();
+	return vec3(r * cosf(phi), r * sinf(phi), z);
+}
+
+// every object is centered at the origin and about two units wide. Candidate rays start on a sphere around it and
+// aim either near the object or anywhere, each is sorted into the hit or the miss pool by the kernel itself. The
+// batch takes the requested share from the hit pool, a pool that stays empty is replaced by the other one.
+template <class Test> static std::vector<Ray> createRays(int count, float hitRatio, Test test)
+{
+	RandomGenerator random;
+	random.seed(1, 1);
+
+	std::vector<Ray> hitPool, missPool;
+	for (int i = 0; i < count * CANDIDATE_ATTEMPTS && (hitPool.size() < count || missPool.size() < count); i++)
+	{
+		vec3 origin = 5 * getRandomDirection(random);
+		vec3 direction = random.uniform() < 0.5f ?
+			normalize(vec3(3 * random.uniform() - 1.5f, 3 * random.uniform() - 1.5f, 3 * random.uniform() - 1.5f) - origin) :
+			getRandomDirection(random);
+
+		Ray ray(origin, direction);
+		if (test(&ray))
+		{
+			if (hitPool.size() < count) hitPool.push_back(Ray(origin, direction));
+		}
+		else if (missPool.size() < count) missPool.push_back(Ray(origin, direction));
+	}
+
+	int hitCount = (int)(hitRatio * count + 0.5f);
+	if (hitPool.empty()) hitCount = 0;
+	if (missPool.empty()) hitCount = count;
+
+	std::vector<Ray> rays;
+	for (int i = 0; i < count; i++)
+	{
+		rays.push_back(i < hitCount ? hitPool[i % hitPool.size()] : missPool[i % missPool.size()]);
+	}
+
+	// hits and misses are interleaved at random, like they are in a frame
+	for (int i = count - 1; i > 0; i--)
+	{
+		std::swap(rays[i], rays[random.uniform(i + 1)]);
+	}
+
+	return rays;
+}
+
+// runs the whole batch until the minimum time has passed, t is reset before every test like a fresh ray
+template <class Test> static KernelResult measure(const char* kernel, const char* call, std::vector<Ray>& rays, float minTime, Test test)
+{
+	for (int i = 0; i < rays.size(); i++)
+	{
+		rays[i].t = INFINITY;
+		test(&rays[i]);
+	}
+
+	KernelResult result;
+	result.kernel = kernel;
+	result.call = call;
+	result.tests = result.hits = 0;
+
+	double start = getSeconds(), end;
+	unsigned long long startCycles = __rdtsc();
+	do
+	{
+		for (int i = 0; i < rays.size(); i++)
+		{
+			rays[i].t = INFINITY;
+			result.hits += test(&rays[i]);
+		}
+		result.tests += rays.size();
+		end = getSeconds();
+	} while ((end - start) * 1000 < minTime);
+	unsigned long long cycles = __rdtsc() - startCycles;
+
+	result.nanoseconds = (end - start) * 1e9 / result.tests;
+	result.cycles = (double)cycles / result.tests;
+
+	printf("%-16s %-8s %8.2f ns %8.2f cycles, %.2f hit\n", kernel, call, result.nanoseconds, result.cycles, (double)result.hits / result.tests);
+	return result;
+}
+
+// the direct, virtual and type switch calls of one primitive, all over the same batch
+static void measurePrimitive(const char* kernel, Primitive* primitive, int rayCount, float hitRatio, float minTime, std::vector<KernelResult>& results)
+{
+	PrimitiveArrays arrays;
+	int reference = arrays.add(primitive);
+
+	std::vector<Ray> rays = createRays(rayCount, hitRatio, [&](Ray* ray) { primitive->intersect(ray); return ray->t < INFINITY; });
+
+	switch (primitive->type)
+	{
+	case spherePrimitive:
+		results.push_back(measure(kernel, "direct", rays, minTime, [&](Ray* ray) { arrays.spheres[0].intersect(ray); return ray->t < INFINITY; }));
+		break;
+	case trianglePrimitive:
+		results.push_back(measure(kernel, "direct", rays, minTime, [&](Ray* ray) { arrays.triangles[0].intersect(ray); return ray->t < INFINITY; }));
+		break;
+	case planePrimitive:
+		results.push_back(measure(kernel, "direct", rays, minTime, [&](Ray* ray) { arrays.planes[0].intersect(ray); return ray->t < INFINITY; }));
+		break;
+	case cylinderPrimitive:
+		results.push_back(measure(kernel, "direct", rays, minTime, [&](Ray* ray) { arrays.cylinders[0].intersect(ray); return ray->t < INFINITY; }));
+		break;
+	default:
+		results.push_back(measure(kernel, "direct", rays, minTime, [&](Ray* ray) { arrays.tori[0].intersect(ray); return ray->t < INFINITY; }));
+		break;
+	}
+
+	results.push_back(measure(kernel, "virtual", rays, minTime, [&](Ray* ray) { primitive->intersect(ray); return ray->t < INFINITY; }));
+	results.push_back(measure(kernel, "switch", rays, minTime, [&](Ray* ray) { arrays.intersect(reference, ray); return ray->t < INFINITY; }));
+}
+
+// the double precision torus test the float kernel replaced: coefficients in long double, roots from the general solver
+static float intersectTorusReference(float R, float r, vec3 position, vec3 axis, Ray* ray)
+{
+	vec3 centerToRayOrigin = ray->origin - position;
+	long double centerToRayOriginDotDirectionSquared = dot(centerToRayOrigin, centerToRayOrigin);
+	long double r2 = r * r;
+	long double R2 = R * R;
+
+	long double axisDotCenterToRayOrigin = dot(axis, centerToRayOrigin);
+	long double axisDotRayDirection = dot(axis, ray->direction);
+	long double a = 1 - axisDotRayDirection * axisDotRayDirection;
+	long double b = 2 * (dot(centerToRayOrigin, ray->direction) - axisDotCenterToRayOrigin * axisDotRayDirection);
+	long double c = centerToRayOriginDotDirectionSquared - axisDotCenterToRayOrigin * axisDotCenterToRayOrigin;
+	long double d = centerToRayOriginDotDirectionSquared + R2 - r2;
+
+	long double B = 4 * dot(ray->direction, centerToRayOrigin);
+	long double C = 2 * d + B * B * 0.25f - 4 * R2 * a;
+	long double D = B * d - 4 * R2 * b;
+	long double E = d * d - 4 * R2 * c;
+
+	QuarticEquation equation(1, B, C, D, E);
+	double roots[4] = { -1.0, -1.0, -1.0, -1.0 };
+	if (equation.Solve(roots) == 0) return INFINITY;
+
+	float closestRoot = INFINITY;
+	for (int i = 0; i < 4; i++)
+	{
+		if (roots[i] >= EPSILON && roots[i] < closestRoot) closestRoot = roots[i];
+	}
+	return closestRoot;
+}
+
+// compares the float torus kernel with the reference over the batch, fails when they disagree beyond the limits
+static bool checkTorusAccuracy(float R, float r, vec3 position, vec3 axis, int rayCount, float hitRatio)
+{
+	Material* material = new Material(vec4(1, 1, 1, 0), diffuse);
+	Torus torus(material, R, r, position, axis);
+	std::vector<Ray> rays = createRays(rayCount, hitRatio, [&](Ray* ray) { torus.intersect(ray); return ray->t < INFINITY; });
+
+	int hits = 0, mismatches = 0;
+	double relativeError = 0, maxRelativeError = 0;
+	for (int i = 0; i < rays.size(); i++)
+	{
+		rays[i].t = INFINITY;
+		torus.intersect(&rays[i]);
+		float t = rays[i].t;
+		float reference = intersectTorusReference(R, r, position, axis, &rays[i]);
+
+		if ((t < INFINITY) != (reference < INFINITY))
+		{
+			mismatches++;
+		}
+		else if (t < INFINITY)
+		{
+			double error = fabs((double)t - reference) / reference;
+			relativeError += error;
+			maxRelativeError = MAX(maxRelativeError, error);
+			hits++;
+		}
+	}
+	relativeError = hits > 0 ? relativeError / hits : 0;
+
+	bool passed = mismatches <= TORUS_MAX_MISMATCH_RATIO * rays.size() && relativeError <= TORUS_MAX_RELATIVE_ERROR;
+	printf("torus accuracy: %d hits, %d of %d rays classified differently, relative t error %.2e mean %.2e max, %s\n",
+		hits, mismatches, (int)rays.size(), relativeError, maxRelativeError, passed ? "passed" : "FAILED");
+	return passed;
+}
+
+static void writeJSON(FILE* file, std::vector<KernelResult>& results, int rayCount, float hitRatio)
+{
+	fprintf(file, "{\n");
+	fprintf(file, "  \"rays\": %d,\n  \"hit_ratio\": %.3f,\n", rayCount, hitRatio);
+	fprintf(file, "  \"kernels\": [\n");
+	for (int i = 0; i < results.size(); i++)
+	{
+		KernelResult& result = results[i];
+		fprintf(file, "    {\n");
+		fprintf(file, "      \"kernel\": \"%s\",\n", result.kernel);
+		fprintf(file, "      \"call\": \"%s\",\n", result.call);
+		fprintf(file, "      \"tests\": %lld,\n", result.tests);
+		fprintf(file, "      \"measured_hit_ratio\": %.3f,\n", (double)result.hits / result.tests);
+		fprintf(file, "      \"ns_per_test\": %.3f,\n", result.nanoseconds);
+		fprintf(file, "      \"cycles_per_test\": %.3f,\n", result.cycles);
+		fprintf(file, "      \"tests_per_cycle\": %.4f\n", 1 / result.cycles);
+		fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+}
+
+static void writeCSV(FILE* file, std::vector<KernelResult>& results, int rayCount, float hitRatio)
+{
+	fprintf(file, "kernel,call,rays,hit_ratio,tests,measured_hit_ratio,ns_per_test,cycles_per_test,tests_per_cycle\n");
+	for (int i = 0; i < results.size(); i++)
+	{
+		KernelResult& result = results[i];
+		fprintf(file, "%s,%s,%d,%.3f,%lld,%.3f,%.3f,%.3f,%.4f\n", result.kernel, result.call, rayCount, hitRatio, result.tests,
+			(double)result.hits / result.tests, result.nanoseconds, result.cycles, 1 / result.cycles);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* format = "json";
+	const char* outputFile = NULL;
+	int rayCount = 4096;
+	float hitRatio = 0.5f, minTime = 200;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* option = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!strcmp(option, "-h") || !strcmp(option, "--help"))
+		{
+			printUsage();
+			return 0;
+		}
+		if (!value)
+		{
+			printf("Missing value of %s\n", option);
+			printUsage();
+			return 1;
+		}
+
+		if (!strcmp(option, "-r") || !strcmp(option, "--rays")) rayCount = atoi(value);
+		else if (!strcmp(option, "--hit-ratio")) hitRatio = atof(value);
+		else if (!strcmp(option, "--min-time")) minTime = atof(value);
+		else if (!strcmp(option, "-f") || !strcmp(option, "--format")) format = value;
+		else if (!strcmp(option, "-o") || !strcmp(option, "--output")) outputFile = value;
+		else
+		{
+			printf("Unknown option %s\n", option);
+			printUsage();
+			return 1;
+		}
+		i++;
+	}
+
+	if (rayCount < 1 || hitRatio < 0 || hitRatio > 1 || minTime <= 0 || (strcmp(format, "json") && strcmp(format, "csv")))
+	{
+		printUsage();
+		return 1;
+	}
+
+	// the results get their own copy of stdout, progress goes to stderr
+	FILE* file = outputFile ? fopen(outputFile, "w") : fdopen(dup(fileno(stdout)), "w");
+	if (!file)
+	{
+		printf("Could not write %s\n", outputFile);
+		return 1;
+	}
+	fflush(stdout);
+	dup2(fileno(stderr), fileno(stdout));
+
+	printf("%d rays per batch, %.2f hit ratio, cycles are time stamp counter ticks\n", rayCount, hitRatio);
+
+	Material* material = new Material(vec4(1, 1, 1, 0), diffuse);
+	std::vector<KernelResult> results;
+
+	measurePrimitive("sphere", new Sphere(material, vec3(0, 0, 0), 1), rayCount, hitRatio, minTime, results);
+	measurePrimitive("triangle", new Triangle(material, vec3(-1, -1, 0), vec3(1, -1, 0), vec3(0, 1, 0)), rayCount, hitRatio, minTime, results);
+	measurePrimitive("plane", new Plane(material, vec3(0, 0, 0), vec3(0, 1, 0)), rayCount, hitRatio, minTime, results);
+	measurePrimitive("cylinder", new Cylinder(material, vec3(0, -1, 0), vec3(0, 1, 0), 0.5f, 2), rayCount, hitRatio, minTime, results);
+	measurePrimitive("torus", new Torus(material, 0.8f, 0.3f, vec3(0, 0, 0), vec3(0, 1, 0)), rayCount, hitRatio, minTime, results);
+	bool torusAccurate = checkTorusAccuracy(0.8f, 0.3f, vec3(0, 0, 0), vec3(0, 1, 0), rayCount, hitRatio);
+
+	BVHNode node;
+	node.setBounds(vec3(-1, -1, -1), vec3(1, 1, 1));
+	std::vector<Ray> rays = createRays(rayCount, hitRatio, [&](Ray* ray) { float entryDistance; return node.intersects(ray, entryDistance); });
+	results.push_back(measure("bvh node", "direct", rays, minTime, [&](Ray* ray) { float entryDistance; return node.intersects(ray, entryDistance); }));
+
+	SphericalLight sphericalLight(vec3(0, 0, 0), 1, vec4(1, 1, 1, 0), 1);
+	rays = createRays(rayCount, hitRatio, [&](Ray* ray) { sphericalLight.intersect(ray); return ray->t < INFINITY; });
+	results.push_back(measure("spherical light", "direct", rays, minTime, [&](Ray* ray) { sphericalLight.intersect(ray); return ray->t < INFINITY; }));
+
+	// a point light is only hit by rays through its exact position, its batch is all misses
+	DirectLight directLight(vec3(0, 0, 0), vec4(1, 1, 1, 0), 1);
+	rays = createRays(rayCount, hitRatio, [&](Ray* ray) { directLight.intersect(ray); return ray->t < INFINITY; });
+	results.push_back(measure("direct light", "direct", rays, minTime, [&](Ray* ray) { directLight.intersect(ray); return ray->t < INFINITY; }));
+
+	if (!strcmp(format, "json")) writeJSON(file, results, rayCount, hitRatio);
+	else writeCSV(file, results, rayCount, hitRatio);
+
+	return fclose(file) == 0 && torusAccurate ? 0 : 1;
+}
@@ -21,57 +21,93 @@
 
 #define MULTITHREADING_ENABLED 1
 #define BVH_ENABLED 1
+#define WAVEFRONT_ENABLED 0 // render rows one path stage at a time for all their paths instead of path by path
+#define BVH_WIDTH 4 // bottom level node width: 2 (binary), 4 (SSE) or 8 (AVX2)
+#define TRIANGLE_PACKET_WIDTH 4 // mesh triangles tested at once in BVH leaves: 1 (scalar), 4 (SSE) or 8 (AVX)
+#define MESH_CACHE_ENABLED 1 // store loaded models with their BVH in a binary file next to the OBJ, see MeshCache
 
 #define STRATA_SIZE 1
 #define STRATA_WIDTH 1.0f / STRATA_SIZE
 
 enum MaterialType { diffuse, mirror, dielectric };
+enum BVHBuildMode { binnedSAH, spatialSplits, mortonCodes };
+enum PrimitiveType { spherePrimitive, trianglePrimitive, planePrimitive, cylinderPrimitive, torusPrimitive };
+enum SamplerType { randomSampler, sobolSampler, rankOneSampler };
 
 // #define FULLSCREEN
 // #define ADVANCEDGL	// faster if your system supports it
 
+// HEADLESS builds (the headless target of the makefile) leave out the window, SDL, OpenGL, FreeImage and Win32
 #include <inttypes.h>
+#ifndef HEADLESS
 extern "C" 
 { 
 #include "glew.h" 
 }
 #include "gl.h"
 #include "io.h"
+#endif
 #include <fstream>
 #include <stdio.h>
+#ifndef HEADLESS
 #include "fcntl.h"
 #include "SDL.h"
 #include "wglext.h"
 #include "freeimage.h"
+#endif
 #include "math.h"
 #include "stdlib.h"
+#include "string.h"
 #include "emmintrin.h"
 #include "immintrin.h"
+#ifndef HEADLESS
 #include "windows.h"
+#endif
 #include "template.h"
 #include "surface.h"
-#include "threads.h"
 #include <assert.h>
 #include <sstream>
 #include <vector>
+#ifndef HEADLESS
 #include <FreeImage.h>
+#endif
 
 #include<random>
 #include<cmath>
 #include<chrono>
+#include<atomic>
+#include<map>
+#include<algorithm>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<deque>
+
+#include "threads.h"
 
 #include "quarticsolver.h"
 
 #include "HDRBitmap.h"
+#include "MappedFile.h"
+#include "ObjLoader.h"
+#include "RandomGenerator.h"
+#include "Sampler.h"
 #include "Ray.h"
 #include "Camera.h"
 #include "BoundingBox.h"
 #include "Primitives.h"
+#include "TriangleMesh.h"
+#include "TrianglePacket.h"
 #include "LightSources.h"
 #include "BVHNode.h"
+#include "MBVH.h"
 #include "BVH.h"
+#include "Instance.h"
 #include "TopBVH.h"
+#include "MeshCache.h"
 #include "Scene.h"
+#include "TileRenderer.h"
+#include "DemoScenes.h"
 
 
 using namespace std;
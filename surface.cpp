@@ -49,6 +49,11 @@ Surface::Surface( char* a_File ) :
 
 void Surface::LoadImage( char* a_File )
 {
+#ifdef HEADLESS
+	char t[128];
+	sprintf( t, "Images can not be loaded without FreeImage: %s", a_File );
+	NotifyUser( t );
+#else
 	FREE_IMAGE_FORMAT fif = FIF_UNKNOWN;
 	fif = FreeImage_GetFileType( a_File, 0 );
 	if (fif == FIF_UNKNOWN) fif = FreeImage_GetFIFFromFilename( a_File );
@@ -65,6 +70,7 @@ void Surface::LoadImage( char* a_File )
 		memcpy( m_Buffer + y * m_Pitch, line, m_Width * sizeof( Pixel ) );
 	}
 	FreeImage_Unload( dib );
+#endif
 }
 
 Surface::~Surface()
@@ -15,7 +15,9 @@
 
 namespace Tmpl8 { 
 
+#ifndef HEADLESS
 double timer::inv_freq = 1;
+#endif
 
 // Math Stuff
 // ----------------------------------------------------------------------------
@@ -74,9 +76,14 @@ mat4 mat4::rotatez( const float a )
 
 void NotifyUser( char* s )
 {
+#ifdef HEADLESS
+	fprintf( stderr, "ERROR: %s\n", s );
+	exit( 1 );
+#else
 	HWND hApp = FindWindow( NULL, TEMPLATE_VERSION );
 	MessageBox( hApp, s, "ERROR", MB_OK );
 	exit( 0 );
+#endif
 }
 
 }
@@ -84,6 +91,9 @@ void NotifyUser( char* s )
 using namespace Tmpl8;
 using namespace std;
 
+// headless builds have their own entry point in headless.cpp
+#ifndef HEADLESS
+
 #ifdef ADVANCEDGL
 
 PFNGLGENBUFFERSPROC glGenBuffers = 0;
@@ -325,4 +335,6 @@ int main( int argc, char **argv )
 	game->Shutdown();
 	SDL_Quit();
 	return 1;
-}
\ No newline at end of file
+}
+
+#endif // HEADLESS
\ No newline at end of file
@@ -8,13 +8,18 @@
 inline float Rand( float range ) { return ((float)rand() / RAND_MAX) * range; }
 inline int IRand( int range ) { return rand() % range; }
 int filesize( FILE* f );
+#ifdef _MSC_VER
 #define MALLOC64(x) _aligned_malloc(x,64)
 #define FREE64(x) _aligned_free(x)
+#else
+#define MALLOC64(x) _mm_malloc(x,64)
+#define FREE64(x) _mm_free(x)
+#endif
 
 typedef unsigned char uchar;
 typedef unsigned char byte;
-typedef __int64 int64;
-typedef unsigned __int64 uint64;
+typedef long long int64;
+typedef unsigned long long uint64;
 typedef unsigned int uint;
 
 namespace Tmpl8 {
@@ -41,6 +46,7 @@ namespace Tmpl8 {
 #define unlikely(expr) __builtin_expect((expr),false)
 #endif
 
+#ifndef HEADLESS
 struct timer 
 { 
 	typedef long long value_type; 
@@ -63,6 +69,7 @@ struct timer
 		inv_freq = 1000./double(f.QuadPart); 
 	} 
 };
+#endif
 
 // vectors
 class vec2 // adapted from https://github.com/dcow/RayTracer
@@ -129,7 +136,11 @@ public:
 class vec4
 {
 public:
+#ifdef _MSC_VER
 	union { struct { float x, y, z, w; }; struct { vec3 xyz; float w2; }; float cell[4]; };
+#else
+	union { struct { float x, y, z, w; }; float cell[4]; }; // anonymous structs can not hold members with constructors
+#endif
 	vec4() {}
 	vec4( float v ) : x( v ), y( v ), z( v ), w( v ) {}
 	vec4( float x, float y, float z, float w ) : x( x ), y( y ), z( z ), w( w ) {}
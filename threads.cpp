@@ -5,95 +5,17 @@
 
 using namespace Tmpl8;
 
-const int Thread::P_ABOVE_NORMAL = THREAD_PRIORITY_ABOVE_NORMAL;
-const int Thread::P_BELOW_NORMAL = THREAD_PRIORITY_BELOW_NORMAL;
-const int Thread::P_HIGHEST = THREAD_PRIORITY_HIGHEST;
-const int Thread::P_IDLE = THREAD_PRIORITY_IDLE;
-const int Thread::P_LOWEST = THREAD_PRIORITY_LOWEST;
-const int Thread::P_NORMAL = THREAD_PRIORITY_NORMAL;
-const int Thread::P_CRITICAL = THREAD_PRIORITY_TIME_CRITICAL;
+void Thread::sleep( long ms ) { std::this_thread::sleep_for( std::chrono::milliseconds( ms ) ); }
 
-unsigned int sthread_proc( void* param ) { Thread* tp = (Thread*)param; tp->run(); return 0; }
-
-void Thread::sleep( long ms ) { Sleep( ms ); }
-void Thread::setPriority( int tp ) { SetThreadPriority( m_hThread, tp ); }
-void Thread::suspend() { SuspendThread( m_hThread ); }
-void Thread::resume() { ResumeThread( m_hThread ); }
-
-void Thread::start() 
-{
-	DWORD tid = 0;	
-	m_hThread = (unsigned long*)CreateThread( NULL, 0, (LPTHREAD_START_ROUTINE)sthread_proc, (Thread*)this, 0, &tid );
-	setPriority( Thread::P_NORMAL );
-}
-
-void Thread::kill()
-{
-	TerminateThread( m_hThread, 0 );
-	CloseHandle( m_hThread );
-	m_hThread = NULL;
-}
-
-void Thread::stop() 
-{
-	if (m_hThread == NULL) return;	
-	WaitForSingleObject( m_hThread, INFINITE );
-	CloseHandle( m_hThread );
-	m_hThread = NULL;
-}
-
-void Thread::SetName( char* _Name )
-{
-	typedef struct tagTHREADNAME_INFO
-	{
-		DWORD dwType;		// must be 0x1000
-		LPCSTR szName;		// pointer to name (in user addr space)
-		DWORD dwThreadID;	// thread ID (-1=caller thread)
-		DWORD dwFlags;		// reserved for future use, must be zero
-	} THREADNAME_INFO;
-	DWORD dwThreadID = GetThreadId( m_hThread );
-	THREADNAME_INFO info;
-	info.dwType = 0x1000;
-	info.szName = _Name;
-	info.dwThreadID = dwThreadID;
-	info.dwFlags = 0;
-	if (::IsDebuggerPresent()) RaiseException( 0x406D1388, 0, sizeof( info ) / sizeof( ULONG_PTR ), (ULONG_PTR*)&info );
-}
-
-DWORD JobThreadProc( LPVOID lpParameter )
+void Thread::start()
 {
-	JobThread* JobThreadInstance = (JobThread*) lpParameter;
-	JobThreadInstance->BackgroundTask();
-	return 0;
-}
-
-void JobThread::CreateAndStartThread( unsigned int threadId )
-{
-	m_GoSignal = CreateEvent( 0, FALSE, FALSE, 0 );
-	m_ThreadHandle = CreateThread( 0, 0, (LPTHREAD_START_ROUTINE) &JobThreadProc, (LPVOID) this, 0, 0 );
-	m_ThreadID = threadId;
-}
-void JobThread::BackgroundTask()
-{
-	while (1)
-	{
-		WaitForSingleObject( m_GoSignal, INFINITE );
-		while (1)
-		{
-			Job* job = JobManager::GetJobManager()->GetNextJob();
-			if (!job) 
-			{
-				JobManager::GetJobManager()->ThreadDone( m_ThreadID );
-				break;
-			}
-			job->RunCodeWrapper();
-		}
-	}
+	m_Thread = std::thread( &Thread::run, this );
 }
 
-void JobThread::Go()
+void Thread::stop()
 {
-	SetEvent( m_GoSignal );
+	if (!m_Thread.joinable()) return;
+	m_Thread.join();
 }
 
 void Job::RunCodeWrapper()
@@ -104,52 +26,117 @@ JobManager* JobManager::m_JobManager = 0;
 
 JobManager::JobManager( unsigned int threads ) : m_NumThreads( threads )
 {
-	InitializeCriticalSection( &m_CS );
+	m_Queues = new JobQueue[threads];
+	m_StealCount = 0;
+	m_Batch = 0;
+	m_BusyThreads = 0;
+	m_Shutdown = false;
+	m_BatchTime = m_TailTime = 0;
 }
 
 JobManager::~JobManager()
 {
-	DeleteCriticalSection( &m_CS );
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_Shutdown = true;
+	}
+	m_GoSignal.notify_all();
+	for (std::thread& thread : m_JobThreadList) thread.join();
+	delete[] m_Queues;
 }
 
 void JobManager::CreateJobManager( unsigned int numThreads )
 {
+	// hardware_concurrency may report 0 when the count is unknown
+	if (numThreads == 0) numThreads = MAX( 1u, std::thread::hardware_concurrency() );
 	m_JobManager = new JobManager( numThreads );
-	m_JobManager->m_JobThreadList = new JobThread[numThreads];
-	for ( unsigned int i = 0 ; i < numThreads; i++ ) 
+	for ( unsigned int i = 0; i < numThreads; i++ )
 	{
-		m_JobManager->m_JobThreadList[i].CreateAndStartThread( i );
-		m_JobManager->m_ThreadDone[i] = CreateEvent( 0, FALSE, FALSE, 0 );
+		m_JobManager->m_JobThreadList.emplace_back( &JobManager::BackgroundTask, m_JobManager, i );
 	}
-	m_JobManager->m_JobCount = 0;
 }
 
-void JobManager::AddJob2( Job* a_Job )
+void JobManager::BackgroundTask( unsigned int threadId )
 {
-	m_JobList[m_JobCount++] = a_Job;
+	unsigned int batch = 0;
+	while (1)
+	{
+		{
+			std::unique_lock<std::mutex> lock( m_Mutex );
+			m_GoSignal.wait( lock, [&] { return m_Shutdown || m_Batch != batch; } );
+			if (m_Shutdown) return;
+			batch = m_Batch;
+		}
+		while (Job* job = GetNextJob( threadId )) job->RunCodeWrapper();
+		m_Queues[threadId].finishTime = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock( m_Mutex );
+			if (--m_BusyThreads == 0) m_DoneSignal.notify_one();
+		}
+	}
 }
 
-Job* JobManager::GetNextJob()
+void JobManager::AddJob2( Job* a_Job )
 {
-	Job* job = 0;
-	EnterCriticalSection( &m_CS );
-	if (m_JobCount > 0) job = m_JobList[--m_JobCount];
-	LeaveCriticalSection( &m_CS );
-	return job;
+	m_JobList.push_back( a_Job );
 }
 
-void JobManager::RunJobs()
+Job* JobManager::GetNextJob( unsigned int threadId )
 {
-	for ( unsigned int i = 0; i < m_NumThreads; i++ ) 
+	// own jobs are taken in the order they were added
+	JobQueue& queue = m_Queues[threadId];
 	{
-		m_JobThreadList[i].Go();
+		std::lock_guard<std::mutex> lock( queue.mutex );
+		if (!queue.jobs.empty())
+		{
+			Job* job = queue.jobs.front();
+			queue.jobs.pop_front();
+			return job;
+		}
+	}
+	// steal the last job of another worker, the one it would have reached last. No jobs are added
+	// during a batch, so the batch is done for this worker once all queues are empty.
+	for ( unsigned int i = 1; i < m_NumThreads; i++ )
+	{
+		JobQueue& victim = m_Queues[(threadId + i) % m_NumThreads];
+		std::lock_guard<std::mutex> lock( victim.mutex );
+		if (!victim.jobs.empty())
+		{
+			Job* job = victim.jobs.back();
+			victim.jobs.pop_back();
+			m_StealCount++;
+			return job;
+		}
 	}
-	WaitForMultipleObjects( m_NumThreads, m_ThreadDone, TRUE, INFINITE );
+	return 0;
 }
 
-void JobManager::ThreadDone( unsigned int n ) 
-{ 
-	SetEvent( m_ThreadDone[n] ); 
+void JobManager::RunJobs()
+{
+	if (m_JobList.empty()) return;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock( m_Mutex );
+	// the workers are idle, their queues can be filled without locking them
+	unsigned int jobCount = (unsigned int)m_JobList.size();
+	for ( unsigned int i = 0; i < m_NumThreads; i++ )
+	{
+		m_Queues[i].jobs.assign( m_JobList.begin() + (size_t)jobCount * i / m_NumThreads, m_JobList.begin() + (size_t)jobCount * (i + 1) / m_NumThreads );
+	}
+	m_StealCount = 0;
+	m_BusyThreads = m_NumThreads;
+	m_Batch++;
+	m_GoSignal.notify_all();
+	m_DoneSignal.wait( lock, [&] { return m_BusyThreads == 0; } );
+	m_JobList.clear();
+
+	std::chrono::steady_clock::time_point firstFinish = m_Queues[0].finishTime, lastFinish = m_Queues[0].finishTime;
+	for ( unsigned int i = 1; i < m_NumThreads; i++ )
+	{
+		firstFinish = MIN( firstFinish, m_Queues[i].finishTime );
+		lastFinish = MAX( lastFinish, m_Queues[i].finishTime );
+	}
+	m_BatchTime = std::chrono::duration<float, std::milli>( lastFinish - start ).count();
+	m_TailTime = std::chrono::duration<float, std::milli>( lastFinish - firstFinish ).count();
 }
 
-// EOF
\ No newline at end of file
+// EOF
@@ -3,31 +3,17 @@
 
 #pragma once
 
-class Thread 
+class Thread
 {
 public:
-	Thread() { m_hThread = 0; }
-	unsigned long* handle() { return m_hThread; }
+	virtual ~Thread() { stop(); }
 	void start();
 	virtual void run() {};
-	void sleep(long ms);
-	void suspend();
-	void resume();
-	void kill();
+	void sleep( long ms );
 	void stop();
-	void setPriority( int p );
-	void SetName( char* _Name );
 private:
-	unsigned long* m_hThread;
-	static const int P_ABOVE_NORMAL;
-	static const int P_BELOW_NORMAL;
-	static const int P_HIGHEST;
-	static const int P_IDLE;
-	static const int P_LOWEST;
-	static const int P_NORMAL;
-	static const int P_CRITICAL;
+	std::thread m_Thread;
 };
-extern "C" { unsigned int sthread_proc( void* param ); }
 
 namespace Tmpl8 {
 
@@ -36,44 +22,51 @@ class Job
 public:
 	virtual void Main() = 0;
 protected:
-	friend class JobThread;
+	friend class JobManager;
 	void RunCodeWrapper();
 };
 
-class JobThread
-{
-public:
-	void CreateAndStartThread( unsigned int threadId );
-	void WaitForThreadToStop();
-	void Go();
-	void BackgroundTask();
-	HANDLE m_GoSignal, m_ThreadHandle;
-	int m_ThreadID;
-};
-
+// runs batches of jobs on a fixed set of worker threads. Jobs are queued with AddJob2 and
+// RunJobs blocks until all of them are done, there is no limit on the number of queued jobs.
+// Every worker gets a contiguous share of the batch in its own queue and steals from the
+// back of the other queues when it runs out, so neighbouring jobs tend to stay on one thread.
 class JobManager	// singleton class!
 {
 protected:
 	JobManager( unsigned int numThreads );
 public:
 	~JobManager();
-	static void CreateJobManager( unsigned int numThreads );
+	static void CreateJobManager( unsigned int numThreads = 0 ); // 0 uses all hardware threads
 	static JobManager* GetJobManager() { return m_JobManager; }
 	void AddJob2( Job* a_Job );
 	unsigned int GetNumThreads() { return m_NumThreads; }
 	void RunJobs();
-	void ThreadDone( unsigned int n );
 	int MaxConcurrent() { return m_NumThreads; }
+	// statistics of the last RunJobs, the tail is the time from the first worker running out of jobs until the batch is done
+	float GetBatchTime() { return m_BatchTime; }
+	float GetTailTime() { return m_TailTime; }
+	unsigned int GetStealCount() { return m_StealCount; }
 protected:
-	friend class JobThread;
-	Job* GetNextJob();
-	Job* FindNextJob();
+	struct alignas(64) JobQueue
+	{
+		std::mutex mutex;
+		std::deque<Job*> jobs;
+		std::chrono::steady_clock::time_point finishTime;
+	};
+	void BackgroundTask( unsigned int threadId );
+	Job* GetNextJob( unsigned int threadId );
 	static JobManager* m_JobManager;
-	Job* m_JobList[64];
-	CRITICAL_SECTION m_CS;
-	HANDLE m_ThreadDone[4];
-	unsigned int m_NumThreads, m_JobCount;
-	JobThread* m_JobThreadList;
+	std::vector<Job*> m_JobList;
+	JobQueue* m_Queues;						// one per worker
+	std::atomic<unsigned int> m_StealCount;
+	std::mutex m_Mutex;
+	std::condition_variable m_GoSignal, m_DoneSignal;
+	unsigned int m_Batch;					// incremented by RunJobs to wake the workers
+	unsigned int m_BusyThreads;
+	bool m_Shutdown;
+	unsigned int m_NumThreads;
+	std::vector<std::thread> m_JobThreadList;
+	float m_BatchTime, m_TailTime;			// milliseconds
 };
 
-}; // namespace Tmpl8
\ No newline at end of file
+}; // namespace Tmpl8